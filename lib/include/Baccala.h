@@ -17,23 +17,44 @@ void PickBestMove(MoveAndPosition* moves, uint8_t n_moves, int i);
 // Perft(pos, depth) returns the number of nodes at the horizon obtained from a given position at a given depth
 // this is also useful for debugging
 // see results at https://www.chessprogramming.org/Perft_Results
-unsigned long long int Perft(Position pos, int depth);
-unsigned long long int PerftNew(Position pos, int depth, StateMemory state);
-void PerftTesting();
-void PerftNewTesting();
+// With bulk_counting = true the recursion stops at depth 1 and returns the number of legal moves,
+// instead of making every move and counting the positions at depth 0 one by one (same result, much faster).
+// The testing functions print the speed in nodes per second. By default they make every move down to depth 0,
+// which also tests make / unmake (or the copy of the children) at the leaves; with bulk_counting = true they are much faster
+unsigned long long int Perft(Position pos, int depth, bool bulk_counting = false);
+unsigned long long int PerftNew(Position& pos, int depth, UndoStack& undo, bool bulk_counting = false);
+unsigned long long int PerftLegal(Position& pos, int depth, UndoStack& undo, bool bulk_counting = false);
+void PerftTesting(bool bulk_counting = false);
+void PerftNewTesting(bool bulk_counting = false);
+void PerftLegalTesting(bool bulk_counting = false);
 
-// MIN - MAX SEARCH with ALPHA - BETA PRUNING
-// at every node of the search we have two values as estimated so far:
-//  - alpha is the MINIMUM score that white (the maximizing player) can obtain so far: they can do at least this or better;
-//  - beta is the MAXIMUM score that black (the minimizing player) can obtain so far: they can do at most this score or better
+// check that GetCoveredSquaresLookup (magic lookup per slider) and GetCoveredSquaresSetwise (Kogge-Stone, scalar and AVX2)
+// give the same result on the perft positions, and print how long each of them takes
+void CoveredSquaresBenchmark();
+
+// total speed of the legal perft (in nodes per second) running in 1, 8 and 32 threads at the same time,
+// with the magic, PEXT and obstruction difference backends for the sliding pieces (see Bitboards.h)
+void SlidersBackendBenchmark();
+
+// NEGAMAX SEARCH with ALPHA - BETA PRUNING
+// the score of a position for one side is the opposite of the score for the other side, so instead of a maximizing (white)
+// and a minimizing (black) player, every node maximizes its own score: the score of a move is minus the score of the child.
+// At every node of the search we have two values, from the point of view of the side to move:
+//  - alpha is the MINIMUM score that the side to move can obtain so far: it can do at least this or better;
+//  - beta is the MAXIMUM score that the opponent allows: if the side to move can do better than beta, the opponent avoids this node
+// The child is searched with the window [-beta, -alpha].
+//
+// PRINCIPAL VARIATION SEARCH (PVS)
+// with a good move ordering the first move is the best one. Only this move is searched with the full window [alpha, beta],
+// the other ones with a null window [alpha, alpha + 1], which only proves that they are not better than alpha (fail low)
+// and cuts much more of the tree. If a move fails high instead, it is searched again with the full window.
+//
+// BestEvaluation keeps the point of view of white (positive scores are good for white, alpha and beta as well),
+// and flips the window and the result when black is to move
 //
-// Let's consider a position P (node), and let's apply a move M that opens a subtree. 
-// We explore the future and obtain an evaluation for M
-// exploring the future, we also update alpha and beta
-// 
 // NULL MOVE LOGIC
 bool SafeNullMoveSearch(Position& pos);
-int BestEvaluation(Position& pos, int anti_depth, int alpha, int beta, /*std::unordered_map<uint64_t, Position>& TranspositionTable,*/ int& n_explored_positions, bool can_do_null);
+int BestEvaluation(Position& pos, UndoStack& undo, int anti_depth, int alpha, int beta, /*std::unordered_map<uint64_t, Position>& TranspositionTable,*/ int& n_explored_positions, bool can_do_null);
 MoveAndPosition BestMove(Position pos, int depth);
 
 // ITERATIVE DEEPENING
@@ -1,40 +1,103 @@
 #pragma once
 #include <cstdint>
+#include <array>
+#include <string>
 #include <Utilities.h>
 
-// change one --> change the others
-const int n_bits_rook = 12; // bits used for magic hashing with rooks
-const int n_bits_bishop = 9; // bits used for magic hashing with bishops
-const int n_attacks_rook = 4096; // 2^n_bits_rook
-const int n_attacks_bishop = 512; // 2^n_bits_bishop
-const int shift_rook = 52; // 64 - n_bits_rook
-const int shift_bishop = 55; // 64 - n_bits_bishop
+// size of the arrays with the attacks of sliding pieces with one bit per relevant blocker (see FANCY MAGIC BITBOARDS below):
+// sum over the squares of 2^(number of relevant blockers of the square).
+// This is the size of the PEXT tables and the largest size of the magic tables (smaller with the densest magics, see DENSEST MAGICS)
+const int n_attacks_rook = 102400; // 4 corners x 2^12 + 24 edges x 2^11 + 36 inner squares x 2^10
+const int n_attacks_bishop = 5248;
+
+constexpr uint64_t file_A = 0x0101010101010101ULL;
+constexpr uint64_t files_bitboards[8] = {
+    file_A, file_A << 1, file_A << 2, file_A << 3, file_A << 4, file_A << 5, file_A << 6, file_A << 7
+};
+
+constexpr uint64_t rank_1 = 0xFF;
+constexpr uint64_t ranks_bitboards[8] = {
+    rank_1, rank_1 << (8*1), rank_1 << (8*2), rank_1 << (8*3), rank_1 << (8*4), rank_1 << (8*5), rank_1 << (8*6), rank_1 << (8*7)
+};
+
+// functions that generate covered square bitboards for non-sliding pieces when the piece is in the square (i, j)
+constexpr uint64_t leaper_covered_squares(int i, int j, const int deltas[][2], int n_deltas){
+    uint64_t bitboard = 0;
+    int i_target = 0, j_target = 0;
+    for(int d = 0; d < n_deltas; d++){
+        i_target = i + deltas[d][0]; 
+        if(i_target < 0 || i_target > 7){ continue; }
+        j_target = j + deltas[d][1];
+        if(j_target < 0 || j_target > 7){ continue; }
+        bitboard |= 1ULL << (8*i_target + j_target);
+    }
+    return bitboard;
+}
+constexpr uint64_t knight_covered_squares(int i, int j){ return leaper_covered_squares(i, j, knight_deltas, 8); }
+constexpr uint64_t king_covered_squares(int i, int j){ return leaper_covered_squares(i, j, king_deltas, 8); }
+constexpr uint64_t white_pawn_covered_squares(int i, int j){ return leaper_covered_squares(i, j, white_pawn_deltas, 2); }
+constexpr uint64_t black_pawn_covered_squares(int i, int j){ return leaper_covered_squares(i, j, black_pawn_deltas, 2); }
+// one square ahead, two from the starting rank
+constexpr uint64_t white_pawn_advance_squares(int i, int j){
+    if(i == 0){ return 0ULL; }
+    return (1ULL << (8*(i - 1) + j)) | ((i == 6) ? (1ULL << (8*(i - 2) + j)) : 0ULL);
+}
+constexpr uint64_t black_pawn_advance_squares(int i, int j){
+    if(i == 7){ return 0ULL; }
+    return (1ULL << (8*(i + 1) + j)) | ((i == 1) ? (1ULL << (8*(i + 2) + j)) : 0ULL);
+}
+
+// COMPILE-TIME TABLES
+// The tables that depend only on the square are filled by the compiler with the functions above and stored in read-only data:
+// nothing to compute at start-up, and a lookup with a constant square is folded by the compiler.
+template<uint64_t (*Generator)(int, int)> constexpr std::array<uint64_t, 64> square_table(){
+    std::array<uint64_t, 64> table{};
+    for(int square = 0; square < 64; square++){
+        table[square] = Generator(square / 8, square % 8);
+    }
+    return table;
+}
+template<uint64_t (*Generator)(int, int)> constexpr std::array<std::array<uint64_t, 64>, 64> square_pair_table(){
+    std::array<std::array<uint64_t, 64>, 64> table{};
+    for(int square1 = 0; square1 < 64; square1++){
+        for(int square2 = 0; square2 < 64; square2++){
+            table[square1][square2] = Generator(square1, square2);
+        }
+    }
+    return table;
+}
 
 // arrays that store all the possible movements of the non-sliding pieces
 // this is used to avoid on-the-fly calculation during the min-max process
-extern uint64_t knight_covered_squares_bitboards[64]; 
-extern uint64_t king_covered_squares_bitboards[64];
-extern uint64_t white_pawn_covered_squares_bitboards[64];
-extern uint64_t black_pawn_covered_squares_bitboards[64]; // when pawns are in first or last raw the array contains garbage
-extern uint64_t white_pawn_advance_squares_bitboards[64];
-extern uint64_t black_pawn_advance_squares_bitboards[64];
-
-// masks of relevant masks of sliding pieces
-extern uint64_t rook_masks[64];
-extern uint64_t rook_magics[64];
-extern uint64_t *rook_covered_squares_bitboards;
-
-extern uint64_t bishop_masks[64];
-extern uint64_t bishop_magics[64];
-extern uint64_t *bishop_covered_squares_bitboards;
+inline constexpr std::array<uint64_t, 64> knight_covered_squares_bitboards = square_table<knight_covered_squares>();
+inline constexpr std::array<uint64_t, 64> king_covered_squares_bitboards = square_table<king_covered_squares>();
+inline constexpr std::array<uint64_t, 64> white_pawn_covered_squares_bitboards = square_table<white_pawn_covered_squares>();
+inline constexpr std::array<uint64_t, 64> black_pawn_covered_squares_bitboards = square_table<black_pawn_covered_squares>();
+inline constexpr std::array<uint64_t, 64> white_pawn_advance_squares_bitboards = square_table<white_pawn_advance_squares>();
+inline constexpr std::array<uint64_t, 64> black_pawn_advance_squares_bitboards = square_table<black_pawn_advance_squares>();
 
-// functions that generate covered square bitboards for non-sliding pieces when the piece is in the square (i, j)
-uint64_t knight_covered_squares(int i, int j);
-uint64_t king_covered_squares(int i, int j);
-uint64_t white_pawn_covered_squares(int i, int j);
-uint64_t white_pawn_advance_squares(int i, int j);
-uint64_t black_pawn_covered_squares(int i, int j);
-uint64_t black_pawn_advance_squares(int i, int j);
+// magic numbers, number of bits of the hash index (n_bits),
+// shift = 64 - n_bits and position of the attacks of the square in the attacks array (offset)
+// (the masks of relevant blockers are below).
+// n_bits is at most the number of relevant blockers of the square (fewer with the densest magics), the offsets follow from it
+// and n_magic_attacks is the size of the attacks array in the magic order. The PEXT order always has one bit per relevant blocker:
+// its offsets are pext_offsets and its size is n_attacks_rook / n_attacks_bishop.
+// Like the attacks, the magics are used where they are: in the mapped file, in the embedded tables or in the engine's own array
+extern const uint64_t *rook_magics;
+extern int rook_n_bits[64];
+extern int rook_shifts[64];
+extern int rook_offsets[64];
+extern int rook_pext_offsets[64];
+extern int n_magic_attacks_rook;
+extern const uint64_t *rook_covered_squares_bitboards;
+
+extern const uint64_t *bishop_magics;
+extern int bishop_n_bits[64];
+extern int bishop_shifts[64];
+extern int bishop_offsets[64];
+extern int bishop_pext_offsets[64];
+extern int n_magic_attacks_bishop;
+extern const uint64_t *bishop_covered_squares_bitboards;
 
 
 // -------------- LOGIC FOR SLIDING PIECES ------------------------
@@ -50,8 +113,32 @@ uint64_t black_pawn_advance_squares(int i, int j);
 // . x x x x x x .
 // notice that the edges are excluded, because if a blocker is on the edge, the rook can still cover the edge site
 // the only pieces that can meaningfully block the sliding are NOT at the edge of the sliding 
-uint64_t rook_relevant_blockers_mask(int i, int j);
-uint64_t bishop_relevant_blockers_mask(int i, int j);
+constexpr uint64_t rook_relevant_blockers_mask(int i, int j){
+    uint64_t bitboard = 0ULL;
+    for(int j_target = 1; j_target < 7; j_target++){
+        if(j_target == j){ continue; }
+        bitboard |= 1ULL << (8*i + j_target);
+    }
+    for(int i_target = 1; i_target < 7; i_target++){
+        if(i_target == i){ continue; }
+        bitboard |= 1ULL << (8*i_target + j);
+    }
+    return bitboard;
+}
+constexpr uint64_t bishop_relevant_blockers_mask(int i, int j){
+    uint64_t bitboard = 0ULL;
+    int i_target = 0, j_target = 0;
+    for(int d = -6; d < 7; d++){
+        // diagonal, then anti-diagonal
+        i_target = i + d; j_target = j + d;
+        if(d != 0 && i_target >= 1 && i_target <= 6 && j_target >= 1 && j_target <= 6){ bitboard |= 1ULL << (8*i_target + j_target); }
+        i_target = i + d; j_target = j - d;
+        if(d != 0 && i_target >= 1 && i_target <= 6 && j_target >= 1 && j_target <= 6){ bitboard |= 1ULL << (8*i_target + j_target); }
+    }
+    return bitboard;
+}
+inline constexpr std::array<uint64_t, 64> rook_masks = square_table<rook_relevant_blockers_mask>();
+inline constexpr std::array<uint64_t, 64> bishop_masks = square_table<bishop_relevant_blockers_mask>();
 // NAIF HASHING: we simply take the mask of all pieces, apply the relevant mask and use the resulting number as a hash
 // rook mask for a1  all pieces bitboard
 // . . . . . . . .   . . . . x . . .        . . . . . . . .
@@ -97,26 +184,231 @@ uint64_t bishop_relevant_blockers_mask(int i, int j);
 // . . . . . . . .      . . . . . . . .
 // . . . x x . . .      . . . x . . . .
 // The magic number is simply generated via trial and error with random numbers.
+//
+// FANCY MAGIC BITBOARDS
+// A rook in a1 has 12 relevant blockers, but a rook in d4 has only 10 (the edges are excluded), a bishop in d4 has 9 and a bishop in a1 has 6.
+// Using n_bits = 12 for every rook square wastes 3/4 of the table for the inner squares: 64 x 4096 x 8 bytes = 2 MB.
+// Instead every square uses its own n_bits = number of relevant blockers, and the attacks of all the squares are packed one after the other:
+//      index = offset[square] + ((blockers & mask[square]) * magic[square]) >> shift[square]
+// rook attacks:   4 x 4096 + 24 x 2048 + 36 x 1024 = 102400 bitboards = 800 KB
+// bishop attacks: 5248 bitboards = 41 KB
+// with fewer bits the magic numbers are harder to find, but the search is done only once (see find_rook_magic)
+//
+// DENSEST MAGICS
+// Thanks to the constructive collisions (different blockers with the same attacks, see above) some squares
+// have magic numbers with fewer bits than their relevant blockers: their part of the attacks array is 2, 4, ... times smaller.
+// So n_bits is stored with the magic numbers (assets/rook_n_bits.txt, the embedded tables, the header of the binary file):
+// without it, every square has one bit per relevant blocker.
 uint64_t rook_covered_squares_from_blockers(uint64_t blockers, int i, int j);
 uint64_t bishop_covered_squares_from_blockers(uint64_t blockers, int i, int j);
 //
 uint64_t rook_blockers_from_integer(uint64_t b, int i, int j);
 uint64_t bishop_blockers_from_integer(uint64_t b, int i, int j);
 //
-void find_rook_magic(unsigned int n_bits, uint64_t *attacks, uint64_t magics[64]);
-void find_bishop_magic(unsigned int n_bits, uint64_t *attacks, uint64_t magics[64]);
+// find the magic numbers of every square for the given number of bits (per square), 
+// and write the attacks in the array at the given offsets.
+// The squares are searched in parallel on n_threads threads (0 = all the hardware threads), and the time spent on every square is printed.
+// All the configurations of blockers and their attacks are computed once per square, before trying the random numbers
+void find_rook_magic(const int n_bits[64], const int offsets[64], uint64_t *attacks, uint64_t magics[64], int n_threads = 0);
+void find_bishop_magic(const int n_bits[64], const int offsets[64], uint64_t *attacks, uint64_t magics[64], int n_threads = 0);
+// for every square, start from a magic number with as many bits as the relevant blockers and remove one bit at a time
+// while a magic number is found within max_trials random numbers: returns the number of bits and the magic of every square,
+// and the total size of the attacks array (also printed, with the size of the fancy magics for comparison).
+// Below the relevant bits the sparse numbers (and the quick rejection) rarely work: denser random numbers are tried too
+int find_densest_rook_magics(int n_bits[64], uint64_t magics[64], uint64_t max_trials, int n_threads = 0);
+int find_densest_bishop_magics(int n_bits[64], uint64_t magics[64], uint64_t max_trials, int n_threads = 0);
 // function that returns hash index for a given config. of blockers on a gien square
-uint64_t rook_hash_index(uint64_t blockers, int square, int n_attacks);
-uint64_t bishop_hash_index(uint64_t blockers, int square, int n_attacks);
+// (only meaningful with the backends that use the attack tables, see below)
+uint64_t rook_hash_index(uint64_t blockers, int square);
+uint64_t bishop_hash_index(uint64_t blockers, int square);
+// attacks of a rook / bishop on the given square for the given configuration of blockers, with the current backend.
+// This is what the rest of the engine calls: for the table backends it is simply
+//      rook_covered_squares_bitboards[rook_hash_index(blockers, square)]
+uint64_t rook_attacks(uint64_t blockers, int square);
+uint64_t bishop_attacks(uint64_t blockers, int square);
+//
+// PEXT BITBOARDS
+// The BMI2 instruction PEXT (parallel bits extract) does the "flattening" of the LESS NAIF HASHING in a single instruction:
+// it takes the bits of the blockers selected by the mask and packs them in the lowest bits of the result
+//      index = offset[square] + _pext_u64(blockers, mask[square])
+// No multiplication, no shift and no magic numbers: the table has the same size as with fancy magics, only the order of the attacks changes.
+// PEXT is not available on older CPUs, and on AMD before Zen 3 it is microcoded and much slower than the magics,
+// so the backend is chosen at start-up (PreComputeBitboards) by asking the CPU with CPUID.
+// Callers don't need to know which backend is used: they always call rook_attacks / bishop_attacks.
+//
+// OBSTRUCTION DIFFERENCE
+// The attack tables take 840 KB: with many search threads on the same socket they compete with the transposition table for the cache.
+// The obstruction difference needs only 4 lines (file, rank, diagonal, anti-diagonal) through every square, split in the part
+// with lower square indexes and the part with higher indexes (4 KB in total). Along one line, for a slider on the square s:
+//      lower = blockers & lower_mask       upper = blockers & upper_mask
+//      the nearest blocker below s is the most significant bit of lower (b1), the nearest above is the least significant of upper (b2)
+//      attacks = (lower_mask | upper_mask) & (2 * b2 - b1)     ---> all the bits from b1 to b2, b1 and b2 included
+// (with b1 = square 0 if lower is empty, and b2 = 0 if upper is empty: then 2 * b2 - b1 has all the bits from b1 up).
+// It costs a bit scan and a few arithmetic operations per line instead of one memory access, but it never misses the cache.
+// Selected at start-up with set_sliders_backend, or at build time with BACCALA_TABLELESS_SLIDERS (see PreComputeBitboards).
+enum SlidersBackend {
+    MAGIC_BACKEND, PEXT_BACKEND, OBSTRUCTION_DIFFERENCE_BACKEND
+};
+extern SlidersBackend sliders_backend;
+// lower and upper half of the file (0), rank (1), diagonal (2) and anti-diagonal (3) through every square, the square excluded
+extern uint64_t line_lower_masks[64][4];
+extern uint64_t line_upper_masks[64][4];
+void get_obstruction_difference_masks();
+// true if the CPU supports BMI2 and PEXT is fast
+bool cpu_has_fast_pext();
+// rewrite the attack tables in the order of the given backend (the obstruction difference doesn't use them)
+void set_sliders_backend(SlidersBackend backend);
+// one bit per relevant blocker for every square (the fancy magics)
+void get_fancy_magic_n_bits();
+// shifts and offsets of every square and size of the magic tables from n_bits, offsets of the PEXT tables from the masks
+void get_magic_offsets();
+// compute the attack tables in the magic order from the magic numbers
+void fill_attack_tables();
+// MAGICS IN THE ASSETS
+// rook_magics.txt, bishop_magics.txt and their number of bits rook_n_bits.txt, bishop_n_bits.txt (one number per square).
+// Reading also computes the offsets; without the n_bits files every square has one bit per relevant blocker
+void read_magics_from_assets(std::string assets_directory);
+void write_magics_to_assets(std::string assets_directory);
+
+// BINARY TABLE FILE
+// The magics and the attack tables can be saved in a binary file that the engine maps read-only in memory at start-up:
+// nothing is parsed or copied, and all the engine processes running on the same machine share the same physical pages.
+// The file is a sequence of 64-bit words:
+//      header:     signature, version, backend (order of the attacks), n_attacks_rook, n_attacks_bishop, checksum of the rest,
+//                  rook_n_bits[64], rook_offsets[64], bishop_n_bits[64], bishop_offsets[64] (layout of the magic order, see DENSEST MAGICS)
+//      body:       rook_magics[64], bishop_magics[64], rook attacks[n_attacks_rook], bishop attacks[n_attacks_bishop]
+// so the attack tables in the body are exactly the arrays used by rook_attacks / bishop_attacks: the table pointers point in the file.
+// n_attacks_rook and n_attacks_bishop are the sizes of the tables in the order of the file: n_magic_attacks in the magic order.
+// A file with a different version, a layout that doesn't add up or a wrong checksum (e.g. written by an older engine, or truncated) is rejected,
+// and PreComputeBitboards silently falls back to the embedded tables (or to the magic numbers in assets/).
+// There is one file per order, attack_tables_magic.bin and attack_tables_pext.bin: PreComputeBitboards chooses the backend first
+// and maps the file of its order, so the tables are used where they are with both backends.
+// The engine never writes the files: GenerateTables writes them at build time next to the embedded tables, and CMake compiles
+// the absolute path of their directory in the library (BACCALA_ATTACK_TABLES_DIR), so it doesn't depend on the working directory.
+constexpr uint64_t attack_tables_signature = 0x414C4143434142ULL; // "BACCALA"
+constexpr uint64_t attack_tables_version = 2;
+constexpr int attack_tables_header_size = 6 + 4 * 64;
+// name of the file of the attack tables in the given order (MAGIC_BACKEND or PEXT_BACKEND)
+std::string attack_tables_file_name(SlidersBackend order);
+// map the file and point the tables in it, false if the file is missing, not valid or not in the given order
+bool map_attack_tables_file(std::string file_name, SlidersBackend order);
+// write the current magics and attack tables (in the current order) in a binary file, false if it fails.
+// The file is written under a unique temporary name and then renamed: a reader never maps a file that is half written
+bool write_attack_tables_file(std::string file_name);
+
+// EMBEDDED TABLES
+// With BACCALA_EMBEDDED_TABLES (the default in CMake), a build step (tools/GenerateTables.cpp) reads the magic numbers from assets/
+// and writes the magics, their number of bits and the attack tables as C++ arrays, compiled in the executable.
+// The attacks are written in both orders: when the binary file is missing, PreComputeBitboards(true) points the magics and the tables
+// of the chosen backend at these arrays, with no text to parse, no copy and no dependence on the working directory.
+#ifdef BACCALA_EMBEDDED_TABLES
+extern const uint64_t embedded_rook_magics[64];
+extern const int embedded_rook_n_bits[64];
+extern const uint64_t embedded_rook_attacks[]; // n_magic_attacks_rook, given by embedded_rook_n_bits
+extern const uint64_t embedded_rook_pext_attacks[n_attacks_rook];
+extern const uint64_t embedded_bishop_magics[64];
+extern const int embedded_bishop_n_bits[64];
+extern const uint64_t embedded_bishop_attacks[];
+extern const uint64_t embedded_bishop_pext_attacks[n_attacks_bishop];
+#endif
 
-// Functions to run at the engine start that pre-calculates covered squares
-void PreComputeBitboards(bool retrieve_from_file);
+// Functions to run at the engine start that pre-calculates covered squares.
+// attack_tables_directory has the binary files to map (see BINARY TABLE FILE): empty for the ones generated at build time, if any
+void PreComputeBitboards(bool retrieve_from_file, std::string attack_tables_directory = "");
 
 // clean-up
 void CleanBitboards();
 
-// generate the bitboard of covered squares from the pieces
-uint64_t GetCoveredSquares(uint64_t pieces[12], uint64_t& all_pieces, bool by_white);
+// squares covered by a pawn of the given color on a given square
+template<Color C> inline const uint64_t* pawn_covered_squares_table(){
+    return (C == WHITE) ? white_pawn_covered_squares_bitboards.data() : black_pawn_covered_squares_bitboards.data();
+}
+
+// generate the bitboard of covered squares from the pieces of the given color
+// (setwise, see below: AVX2 if the CPU has it, decided in PreComputeBitboards, scalar otherwise)
+template<Color C> uint64_t GetCoveredSquares(const uint64_t pieces[12], const uint64_t& all_pieces);
+// same result, looping over the pieces with one attack lookup (magic or PEXT) for each of them
+template<Color C> uint64_t GetCoveredSquaresLookup(const uint64_t pieces[12], const uint64_t& all_pieces);
+// same, choosing the color at run-time
+uint64_t GetCoveredSquares(const uint64_t pieces[12], const uint64_t& all_pieces, bool by_white);
+
+// KOGGE-STONE OCCLUDED FILL
+// Instead of looking up the attacks of every slider, the attacks of ALL the rooks (or bishops) are computed at once along a direction,
+// by shifting their bitboard and letting it flow through the empty squares. With log2(7) = 3 steps of doubling length (1, 2, 4 squares):
+//      gen = sliders, pro = empty squares
+//      gen |= pro & (gen << 1);   pro &= pro << 1;     ---> sliders + 1 square
+//      gen |= pro & (gen << 2);   pro &= pro << 2;     ---> sliders + 3 squares
+//      gen |= pro & (gen << 4);                        ---> sliders + 7 squares
+//      attacks = gen << 1                              ---> the squares attacked, up to the first blocker included
+// (with shifts of 8 for south, 9 / 7 for the diagonals, negative for the opposite directions, and file masks against wrapping).
+// There are no tables and no loop over the pieces; the AVX2 version runs 4 directions in every 256-bit register, so the 8 directions
+// of rooks, bishops and queens take two registers. Queens are both rooks and bishops.
+uint64_t sliding_attacks_kogge_stone(uint64_t rooks, uint64_t bishops, uint64_t empty);
+uint64_t sliding_attacks_kogge_stone_avx2(uint64_t rooks, uint64_t bishops, uint64_t empty); // only if cpu_has_avx2()
+bool cpu_has_avx2();
+extern bool use_avx2;
+// same result as GetCoveredSquares, with setwise sliders (Kogge-Stone, AVX2 or scalar fallback) and pawns
+template<Color C> uint64_t GetCoveredSquaresSetwise(const uint64_t pieces[12], const uint64_t& all_pieces, bool use_avx2);
+
+// Bitboards of the squares lying on the segment and on the full line through two squares
+// e.g. squares_between[e1][e8] and line_through[e1][e8] for a king in e1 and a rook in e8:
+// . . . . o . . .      . . . . x . . .
+// . . . . x . . .      . . . . x . . .
+// . . . . x . . .      . . . . x . . .
+// . . . . x . . .      . . . . x . . .
+// . . . . x . . .      . . . . x . . .
+// . . . . x . . .      . . . . x . . .
+// . . . . x . . .      . . . . x . . .
+// . . . . o . . .      . . . . x . . .
+// if the two squares are not on the same rank, file or diagonal both bitboards are empty.
+// They are used in legal move generation: a piece pinned to its king can only move along line_through[king][piece]
+// and a single check by a slider can be blocked by moving a piece on squares_between[king][checker]
+constexpr uint64_t line_bitboard(int square1, int square2){
+    int i1 = square1 / 8, j1 = square1 % 8, i2 = square2 / 8, j2 = square2 % 8;
+    if(square1 == square2){ return 0ULL; }
+    if(i1 == i2){ return ranks_bitboards[i1]; }
+    if(j1 == j2){ return files_bitboards[j1]; }
+    // the diagonal a8-h1 (i = j) moved down by i - j ranks
+    constexpr uint64_t diagonal = 0x8040201008040201ULL;
+    if(i1 - j1 == i2 - j2){ return (i1 >= j1) ? (diagonal << 8*(i1 - j1)) : (diagonal >> 8*(j1 - i1)); }
+    // the anti-diagonal h8-a1 (i + j = 7) moved down by i + j - 7 ranks
+    constexpr uint64_t anti_diagonal = 0x0102040810204080ULL;
+    if(i1 + j1 == i2 + j2){ return (i1 + j1 >= 7) ? (anti_diagonal << 8*(i1 + j1 - 7)) : (anti_diagonal >> 8*(7 - i1 - j1)); }
+    return 0ULL;
+}
+// the squares of the line with index strictly between the two squares
+constexpr uint64_t between_bitboard(int square1, int square2){
+    int low = (square1 < square2) ? square1 : square2;
+    int high = (square1 < square2) ? square2 : square1;
+    return line_bitboard(square1, square2) & ((1ULL << high) - (2ULL << low));
+}
+inline constexpr std::array<std::array<uint64_t, 64>, 64> squares_between = square_pair_table<between_bitboard>();
+inline constexpr std::array<std::array<uint64_t, 64>, 64> line_through = square_pair_table<line_bitboard>();
+// squares seen by a rook / bishop on the empty board: the rank and the file, or the two diagonals through the square (square excluded)
+constexpr uint64_t rook_rays(int i, int j){ return (ranks_bitboards[i] | files_bitboards[j]) & ~(1ULL << (8*i + j)); }
+constexpr uint64_t bishop_rays(int i, int j){
+    uint64_t rays = 0ULL;
+    for(int square = 0; square < 64; square++){
+        if(square / 8 != i && square % 8 != j){ rays |= line_bitboard(8*i + j, square); }
+    }
+    return rays & ~(1ULL << (8*i + j));
+}
+inline constexpr std::array<uint64_t, 64> rook_rays_bitboards = square_table<rook_rays>();
+inline constexpr std::array<uint64_t, 64> bishop_rays_bitboards = square_table<bishop_rays>();
+
+// Move all the bits of a bitboard by Delta squares (square + Delta), e.g. Delta = -8 pushes all the white pawns at once.
+// Bits moving one file left (Delta = -9, 7) or right (Delta = -7, 9) must not wrap around the board,
+// so the pieces on the a-file (respectively h-file) are removed before shifting:
+// . . . . . . . .        . . . . . . . .
+// . . . . . . . .        . . . . . . . .
+// . . . . . . . .        x . . . . . x .
+// x . . . . . . x  -9->  . . . . . . . .   (the pawn on the a-file doesn't reappear on the h-file)
+template<int Delta> constexpr uint64_t shift_bitboard(uint64_t bitboard){
+    if constexpr(Delta == -9 || Delta == 7){ bitboard &= ~files_bitboards[0]; }
+    if constexpr(Delta == -7 || Delta == 9){ bitboard &= ~files_bitboards[7]; }
+    if constexpr(Delta > 0){ return bitboard << Delta; }
+    else{ return bitboard >> (-Delta); }
+}
 
 // Bitboards to detect passed pawns and outposts
 // . . . . . . . .
@@ -136,16 +428,6 @@ uint64_t GetCoveredSquares(uint64_t pieces[12], uint64_t& all_pieces, bool by_wh
 // . . . x x x . . 
 // . . . x x x . .
 // . . . . . . . .
-constexpr uint64_t file_A = 0x0101010101010101ULL;
-constexpr uint64_t files_bitboards[8] = {
-    file_A, file_A << 1, file_A << 2, file_A << 3, file_A << 4, file_A << 5, file_A << 6, file_A << 7
-};
-
-constexpr uint64_t rank_1 = 0xFF;
-constexpr uint64_t ranks_bitboards[8] = {
-    rank_1, rank_1 << (8*1), rank_1 << (8*2), rank_1 << (8*3), rank_1 << (8*4), rank_1 << (8*5), rank_1 << (8*6), rank_1 << (8*7)
-};
-
 extern uint64_t mask_white_passed_pawn[64];
 extern uint64_t mask_black_passed_pawn[64];
 
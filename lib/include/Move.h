@@ -42,21 +42,6 @@ typedef uint32_t Move;
 //      flags = 15 -> capture and promotion to queen
 typedef uint16_t MoveNew;
 
-struct StateMemory{
-    //uint64_t moved_piece = 0ULL;
-    uint64_t captured_piece = 0ULL;
-    uint64_t friendly_pieces = 0ULL;
-    uint64_t enemy_pieces = 0ULL;
-    uint64_t en_passant_target_square;
-    uint8_t moved_piece_index = 0;
-    uint8_t captured_piece_index = 0;
-    uint8_t half_move_counter = 0;
-    bool can_white_castle_kingside = false;
-    bool can_white_castle_queenside = false;
-    bool can_black_castle_kingside = false;
-    bool can_black_castle_queenside = false;
-};
-
 // define a null move: flags = 0; promo = 15; capt = 15; piece = 15; to = 0; from = 0;
 const Move NULL_MOVE = 16773120;
 
@@ -0,0 +1,55 @@
+#pragma once
+#include <Move.h>
+#include <Position.h>
+
+// KILLER MOVES
+// a quiet move that caused a beta cutoff is likely to cause a cutoff also in the sibling nodes (same ply, different position)
+// e.g. a move that wins material or threatens mate regardless of what the opponent did in the previous move.
+// We keep the last two killers for every ply (distance from the root, i.e. UndoStack::ply)
+extern MoveNew killer_moves[MAX_PLY][2];
+
+// clear the killers (at the beginning of a new search)
+void ClearKillerMoves();
+
+// store a move as killer for the given ply, only if it is a quiet move (captures are already sorted first)
+void StoreKillerMove(const MoveNew& move, int ply);
+
+// MOVE PICKER
+// In the alpha-beta search, most of the time the first move(s) cause a beta cutoff and the other moves are never searched.
+// Instead of generating and sorting all the legal moves in advance, the move picker returns them one at a time in stages:
+//  1. HASH MOVE: the best move stored in the transposition table for this position. It is checked for legality
+//     without generating anything, and if the search cuts here, no move is ever generated
+//  2. CAPTURES: captures and promotions, generated only when the hash move didn't cut, picked by MVV - LVA (see ScoreMove).
+//     A capture of a less valuable piece that loses material (StaticExchangeEvaluation < 0) is put aside
+//  3. KILLERS: the killer moves of the current ply, if they are legal in this position
+//  4. QUIETS: all the other moves, generated only if the previous stages failed to cut
+//  5. BAD CAPTURES: the losing captures put aside in stage 2
+// Moves already returned in a previous stage are skipped.
+// Usage:
+//      MovePicker picker(pos, hash_move, undo.ply);
+//      while((move = picker.NextMove()) != 0){ ... }
+// The position can be modified between the calls, as long as it is restored (MakeMove followed by UnmakeMove)
+enum PickerStage {
+    HASH_MOVE, GENERATE_CAPTURES, PICK_CAPTURES, KILLER_MOVES, GENERATE_QUIETS, PICK_QUIETS, BAD_CAPTURES, NO_MORE_MOVES
+};
+
+struct MovePicker
+{
+    const Position& pos;
+    PickerStage stage = HASH_MOVE;
+    MoveNew hash_move;
+    MoveNew killers[2];
+    MoveNew moves[MAX_NUMBER_OF_MOVES];
+    int scores[MAX_NUMBER_OF_MOVES];
+    MoveNew bad_captures[MAX_NUMBER_OF_MOVES];
+    uint8_t n_moves = 0;
+    uint8_t current = 0;
+    uint8_t current_killer = 0;
+    uint8_t n_bad_captures = 0;
+    uint8_t current_bad_capture = 0;
+
+    MovePicker(const Position& pos, MoveNew hash_move, int ply);
+
+    // returns the next move, or 0 if there are no moves left
+    MoveNew NextMove();
+};
@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <Move.h>
+#include <Bitboards.h>
 
 // Class Position is made as follows:
 // - 12 bitboards storing the position of the 12 types of pieces: K Q R B N P k q r b n p
@@ -15,8 +16,16 @@
 //      from 0 to 50 and we have 2 extra bits
 // - 1 uint8_t n_legal_moves representing the number of legal moves
 //      from 0 to 2^8 - 1 = 255 (max allowed size is 256)
+// - 1 uint64_t hash: the Zobrist key of the position (see TranspositionTable.h)
+//      it is computed from scratch only in PositionFromFen, then MakeMove / UnmakeMove update it with a few XORs
+// - 64 uint8_t piece_on: mailbox board with the index of the piece (0, ..., 11) on each square, or NO_PIECE if empty.
+//      It is redundant with the bitboards, but it answers "what piece is on this square?" with a single load
+// The squares covered by each side are not stored: they are computed when they are needed (see COVERED SQUARES below)
 // TOTAL MEMORY REQUIRED 
 // 64 x 12 + 64 x 3 + 64 x 1 + 8 x 1 + 8 x 1 + 8 x 1 = 1048 bits = 131 bytes
+// value of piece_on for an empty square
+const uint8_t NO_PIECE = 12;
+
 struct Position
 {
     uint64_t pieces[12] = {
@@ -35,11 +44,19 @@ struct Position
     uint64_t white_pieces = 0ULL;
     uint64_t black_pieces = 0ULL;
     uint64_t all_pieces = 0ULL;
-    uint64_t white_covered_squares = 0ULL;
-    uint64_t black_covered_squares = 0ULL;
     uint8_t n_legal_moves = 0;
+    uint64_t hash = 0ULL;
+    uint8_t piece_on[64]; // initialized in PositionFromFen
 };
 
+// pieces and castling rights of a given color, resolved at compile time (see ColorTraits)
+template<Color C> inline uint64_t& PiecesOf(Position& pos){ return (C == WHITE) ? pos.white_pieces : pos.black_pieces; }
+template<Color C> inline const uint64_t& PiecesOf(const Position& pos){ return (C == WHITE) ? pos.white_pieces : pos.black_pieces; }
+template<Color C> inline bool& CanCastleKingside(Position& pos){ return (C == WHITE) ? pos.can_white_castle_kingside : pos.can_black_castle_kingside; }
+template<Color C> inline bool CanCastleKingside(const Position& pos){ return (C == WHITE) ? pos.can_white_castle_kingside : pos.can_black_castle_kingside; }
+template<Color C> inline bool& CanCastleQueenside(Position& pos){ return (C == WHITE) ? pos.can_white_castle_queenside : pos.can_black_castle_queenside; }
+template<Color C> inline bool CanCastleQueenside(const Position& pos){ return (C == WHITE) ? pos.can_white_castle_queenside : pos.can_black_castle_queenside; }
+
 Position PositionFromFen(std::string fen);
 
 void PrintBoard(Position pos);
@@ -54,23 +71,132 @@ struct MoveAndPosition
     int score;
 };
 
+// Type of moves requested to the move generators:
+//  - CAPTURES: captures (en-passant included) and promotions, e.g. for the quiescence search or the first stages of the move picker
+//  - QUIETS: all the other moves (castling included)
+//  - ALL_MOVES: both
+// the two partial types are masked on the target squares, so they are cheaper than generating everything and filtering.
+enum GenType {
+    CAPTURES, QUIETS, ALL_MOVES
+};
+
 // Generate all the PSEUDOLEGAL moves, which means:
 //  - move a piece from a square to another square following the rules
 //  - if the square is occupied by a friendly piece, don't consider the move
 //  - ignore if the move leaves the king in danger (whence PSEUDOlegal)
-void PseudoLegalMoves(const Position& pos, MoveNew* moves);
+// Us is the side to move; the version without template parameter reads it from pos.white_to_move
+template<Color Us> void PseudoLegalMoves(const Position& pos, MoveNew* moves, GenType type = ALL_MOVES);
+void PseudoLegalMoves(const Position& pos, MoveNew* moves, GenType type = ALL_MOVES);
 
-void MakeMove(Position& pos, const MoveNew& move, StateMemory& state);
+// Information of a position that cannot be recovered from the move alone when we unmake it.
+// The moved piece is not stored: after the move it sits on the target square (or it was a pawn, in case of promotion)
+// and the group bitboards are restored incrementally from the squares of the move.
+struct StateMemory{
+    uint64_t en_passant_target_square = 0ULL;
+    uint8_t captured_piece_index = NO_PIECE;
+    uint8_t half_move_counter = 0;
+    bool can_white_castle_kingside = false;
+    bool can_white_castle_queenside = false;
+    bool can_black_castle_kingside = false;
+    bool can_black_castle_queenside = false;
+};
+
+// maximum depth of a line of moves made on a single position (search + quiescence + perft)
+const int MAX_PLY = 128;
 
+// Undo stack: MakeMove pushes the StateMemory of the current position, UnmakeMove pops it.
+// It has a fixed capacity (no heap allocations) and it is indexed by ply, 
+// so every search thread owns one and passes it by reference down the tree.
+//      Position pos = PositionFromFen(fen);
+//      UndoStack undo;
+//      MakeMove(pos, move, undo);   // undo.ply = 1
+//      ...
+//      UnmakeMove(pos, move, undo); // undo.ply = 0
+struct UndoStack{
+    StateMemory states[MAX_PLY];
+    int ply = 0;
+};
+
+// COVERED SQUARES
+// The squares covered by a side are needed only by a few tests (castling, check, stalemate, danger squares of the king),
+// about once per node, so they are computed when asked with GetCoveredSquares (setwise fill, see Bitboards.h).
+// Neither MakeMove nor UnmakeMove spends anything on them.
+//      if(CoveredSquares<~Us>(pos) & pos.pieces[friendly]){ ... } // we are in check
+template<Color C> inline uint64_t CoveredSquares(const Position& pos){ return GetCoveredSquares<C>(pos.pieces, pos.all_pieces); }
+
+// Us is always the side that makes the move: the side to move for MakeMove,
+// the side that has just moved for IsLegal and UnmakeMove.
+// Inside the search the color is known, so call the template versions and avoid the dispatch on pos.white_to_move
+template<Color Us> void MakeMove(Position& pos, const MoveNew& move, UndoStack& undo);
+void MakeMove(Position& pos, const MoveNew& move, UndoStack& undo);
+
+// A move coming from outside the move generator (hash move, killer) may belong to another position:
+// IsPseudoLegal checks, on the board and with the attack tables, that it is a possible move of the piece on its starting square
+// (right piece, target square, path, castling rights), without generating any move. Us is the side to move.
+// It doesn't check that our king is safe after the move: that is IsLegal, after MakeMove
+//      if(IsPseudoLegal<Us>(pos, move)){ MakeMove<Us>(pos, move, undo); if(IsLegal<Us>(pos, move)){ ... } UnmakeMove<Us>(pos, move, undo); }
+template<Color Us> bool IsPseudoLegal(const Position& pos, const MoveNew& move);
+bool IsPseudoLegal(const Position& pos, const MoveNew& move);
+
+template<Color Us> bool IsLegal(Position& pos, const Move& move);
 bool IsLegal(Position& pos, const Move& move);
 
-void UnmakeMove(Position& pos, const MoveNew& move, const StateMemory& state);
+template<Color Us> void UnmakeMove(Position& pos, const MoveNew& move, UndoStack& undo);
+void UnmakeMove(Position& pos, const MoveNew& move, UndoStack& undo);
 
-// Generate all the possible moves following the rules, 
-// but without checking if the king is left in danger by that move.
-// This is done later! So these moves are technically NOT the legal moves 
+// Generate all the legal moves together with the position after each move (copy-make).
+// The moves come from LegalMovesNew and are applied with MakeMove on a copy of the position
+template<Color Us> void LegalMoves(Position& pos, MoveAndPosition* legal_moves);
 void LegalMoves(Position& pos, MoveAndPosition* legal_moves);
 
+// Generate only the LEGAL moves, without copying the position for every candidate move.
+// Once per node we compute:
+//  - checkers: enemy pieces attacking our king
+//  - pinned pieces: friendly pieces that can only move along the line through our king
+//  - danger: squares covered by the opponent (with our king removed from the board), forbidden to our king
+// in check, the non-king moves are restricted to capturing the checker or blocking it; in double check only the king moves.
+// The moves are written in the array and their number is returned; the type selects captures, quiet moves or all of them.
+template<Color Us> uint8_t LegalMovesNew(const Position& pos, MoveNew* moves, GenType type = ALL_MOVES);
+uint8_t LegalMovesNew(const Position& pos, MoveNew* moves, GenType type = ALL_MOVES);
+
+// true if the side to move has at least one legal move (i.e. it's not checkmate or stalemate).
+// No move is generated: it stops at the first legal move, trying the king moves first
+template<Color Us> bool HasLegalMove(const Position& pos);
+bool HasLegalMove(const Position& pos);
+
+// attackers (of both colors) to a given square, for a given occupancy of the board.
+// The sliders are looked up in the attack tables with the given occupancy, so removing pieces from it reveals the x-rays
+uint64_t AttackersTo(const Position& pos, unsigned long square, uint64_t occupancy);
+
+// STATIC EXCHANGE EVALUATION (SEE)
+// material won (> 0) or lost (< 0) by the side to move with the sequence of captures on the target square of the move,
+// where both sides always capture with their least valuable piece and can stop capturing when it's convenient.
+// When a piece captures, the sliders behind it (x-rays) join the exchange.
+// Pins and checks are ignored, and only the first move can be a promotion.
+// The move ordering uses it to put the losing captures after the quiet moves
+int StaticExchangeEvaluation(const Position& pos, const MoveNew& move);
+
+// CHECK INFO
+// To know if a move gives check we don't need to make it and compute the covered squares: once per node we compute
+//  - check_squares: for every piece type (K, Q, R, B, N, P as in pos.pieces), the squares from which it would attack the enemy king
+//  - discovered_check_candidates: our pieces that are the only piece between one of our sliders and the enemy king
+// Then a move gives a direct check if the piece lands on one of its check squares, and a discovered check if it is a candidate
+// leaving the line through the enemy king. Only castling, en-passant and promotions (rare) look up the attacks again.
+// Us is the side that makes the moves.
+//      CheckInfo info = ComputeCheckInfo<Us>(pos);
+//      bool is_check = GivesCheck<Us>(pos, info, move);
+struct CheckInfo{
+    uint64_t check_squares[6];
+    uint64_t discovered_check_candidates;
+    uint8_t enemy_king_square;
+};
+
+template<Color Us> CheckInfo ComputeCheckInfo(const Position& pos);
+CheckInfo ComputeCheckInfo(const Position& pos);
+
+template<Color Us> bool GivesCheck(const Position& pos, const CheckInfo& info, const MoveNew& move);
+bool GivesCheck(const Position& pos, const CheckInfo& info, const MoveNew& move);
+
 // Consider all the moves, filter out illegal moves that leave the king in check and generate the new position
 // This function is optimized for the engine purposes:
 // if we check the legality of a move first and then use it to update the position, we are forced to generate 
@@ -22,7 +22,7 @@ struct TTEntry {
     uint64_t hash;
     int score;
     NodeFlag flag;
-    //Move best_move;
+    MoveNew best_move; // 0 if no move is known (e.g. all moves failed low)
 };
 
 // Transposition Table (TT)
@@ -40,7 +40,7 @@ TTEntry* TTProbe(uint64_t zobrist_key);
 // store entry in the table ONLY in 2 cases:
 // - if the table at that index is empty
 // - if the depth of the entry that we are storing is greater than the depth of the entry that we attempt to overwrite
-void TTStore(int depth, uint64_t hash, int score, NodeFlag flag/*, Move best_move*/);
+void TTStore(int depth, uint64_t hash, int score, NodeFlag flag, MoveNew best_move);
 
 // Zobrist hashing is a method to map a position to a (almost unique) number:
 //                   Zobrist hashing
@@ -74,5 +74,25 @@ extern ZobristTable zobrist_table;
 
 void InitializeZobrist();
 
-// careful: this function is called inside the search loop: it has to be as fast as possible
-uint64_t ZobristHashing(Position& pos);
\ No newline at end of file
+// full computation of the Zobrist key, scanning all the pieces.
+// The search does NOT call this: the key is kept up to date in pos.hash by MakeMove / UnmakeMove,
+// this function is only used to initialize pos.hash and to check the incremental updates in debug builds
+uint64_t ZobristHashing(const Position& pos);
+
+// Zobrist key of the castling rights alone (used for the incremental update of the key)
+inline uint64_t ZobristCastling(const Position& pos){
+    uint64_t hash = 0ULL;
+    if(pos.can_white_castle_kingside){ hash ^= zobrist_table.castling_rights[0]; }
+    if(pos.can_white_castle_queenside){ hash ^= zobrist_table.castling_rights[1]; }
+    if(pos.can_black_castle_kingside){ hash ^= zobrist_table.castling_rights[2]; }
+    if(pos.can_black_castle_queenside){ hash ^= zobrist_table.castling_rights[3]; }
+    return hash;
+}
+
+// Zobrist key of the en-passant target file alone (0 if there is no en-passant target)
+inline uint64_t ZobristEnPassant(const Position& pos){
+    unsigned long square;
+    if(pos.en_passant_target_square == 0){ return 0ULL; }
+    square = get_last_active_bit(pos.en_passant_target_square);
+    return zobrist_table.en_passant_file[square % 8];
+}
\ No newline at end of file
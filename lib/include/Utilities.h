@@ -2,7 +2,10 @@
 #include <iostream>
 #include <string>
 #include <cstdint>
-#include <bitset>
+#include <limits>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
 
 // random generator of 64-bit unsigned integers
 uint64_t rand64();
@@ -11,8 +14,17 @@ uint64_t rand64();
 int IntPow(int x, unsigned int p);
 
 // write / read bitboard array to / from file
-void write_to_file(uint64_t* arr, size_t size, std::string file_name);
+void write_to_file(const uint64_t* arr, size_t size, std::string file_name);
 void read_from_file(uint64_t* arr, size_t size, std::string file_name);
+// same in binary: the numbers are stored as they are in memory (8 bytes each), without parsing.
+// Returns false if the file cannot be opened or the write fails (e.g. disk full)
+bool write_to_binary_file(const uint64_t* arr, size_t size, std::string file_name);
+// rename a file, replacing the destination if it exists (in a single step: a reader sees either the old or the new file)
+bool replace_file(std::string old_file_name, std::string new_file_name);
+// map a binary file read-only in memory (size = number of 64-bit words), nullptr if it fails.
+// The pages are shared by all the processes that map the same file
+const uint64_t* map_binary_file(std::string file_name, size_t& size);
+void unmap_binary_file(const uint64_t* data, size_t size);
 
 // relevant positions
 const std::string starting_position_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 0";
@@ -48,27 +60,101 @@ const int n_squares_for_bishop_blockers[64] = {
     6, 5, 5, 5, 5, 5, 5, 6
 };
 
+// COLORS
+// Move generation, make / unmake and legality checks are templates on the color of the side to move:
+// every color gets its own copy of the code where piece indexes, pawn directions and castling squares are compile-time constants.
+// The search dispatches once on pos.white_to_move and then calls the specialized functions.
+enum Color {
+    WHITE, BLACK
+};
+
+constexpr Color operator~(Color color){ return color == WHITE ? BLACK : WHITE; }
+
+// constants depending on the color (squares are numbered 0 = a8, ..., 63 = h1)
+template<Color C> struct ColorTraits {
+    static constexpr uint8_t friendly = (C == WHITE) ? 0 : 6; // index of the king in pos.pieces (then Q, R, B, N, P follow)
+    static constexpr uint8_t enemy = (C == WHITE) ? 6 : 0; // index of the opponent's king in pos.pieces
+    static constexpr int pawn_push = (C == WHITE) ? -8 : 8; // white pawns move towards lower squares
+    static constexpr int starting_rank = (C == WHITE) ? 6 : 1;
+    static constexpr int double_push_rank = (C == WHITE) ? 4 : 3;
+    static constexpr int promotion_rank = (C == WHITE) ? 0 : 7;
+    static constexpr uint8_t king_home = (C == WHITE) ? 60 : 4;
+    static constexpr uint8_t kingside_rook_home = (C == WHITE) ? 63 : 7;
+    static constexpr uint8_t queenside_rook_home = (C == WHITE) ? 56 : 0;
+};
+
 const uint64_t BLACK_QUEENSIDE_CASTLE_MASK = (7ULL << 2);
 const uint64_t BLACK_KINGSIDE_CASTLE_MASK = (7ULL << 4);
 const uint64_t WHITE_QUEENSIDE_CASTLE_MASK = (7ULL << 58);
 const uint64_t WHITE_KINGSIDE_CASTLE_MASK = (7ULL << 60);
 
 // bit-wise operations for bitboards
-void bit_set(uint64_t& bitboard, int i, int j);
-void bit_set(uint64_t& bitboard, unsigned long& square);
-void bit_set_opt(uint64_t& bitboard, const uint8_t& square);
+// They are all defined here (header-only) so that the loops of move generation and hashing inline them.
+// With GCC / Clang they are builtins and they are constexpr, with MSVC they are the intrinsics, which are not constexpr.
+// Both toolchains use POPCNT and BLSR only with the CMake option BACCALA_BIT_INSTRUCTIONS (the CPU must have them):
+// with GCC / Clang it adds -mpopcnt -mbmi -mlzcnt, with MSVC it defines BACCALA_BIT_INSTRUCTIONS.
+// Without it, pop_count is a few portable instructions (no library call) and the binary runs on any x86-64 CPU.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define BITBOARD_CONSTEXPR inline
+#else
+#define BITBOARD_CONSTEXPR constexpr inline
+#endif
+
+BITBOARD_CONSTEXPR void bit_set(uint64_t& bitboard, int i, int j){ bitboard |= (1ULL << (8*i+j)); }
+BITBOARD_CONSTEXPR void bit_set(uint64_t& bitboard, unsigned long square){ bitboard |= (1ULL << square); }
+BITBOARD_CONSTEXPR void bit_set_opt(uint64_t& bitboard, uint8_t square){ bitboard |= (1ULL << square); }
+
+BITBOARD_CONSTEXPR void bit_clear(uint64_t& bitboard, int i, int j){ bitboard &= ~(1ULL << (8*i+j)); }
+BITBOARD_CONSTEXPR void bit_clear(uint64_t& bitboard, unsigned long square){ bitboard &= ~(1ULL << square); }
+BITBOARD_CONSTEXPR void bit_clear_opt(uint64_t& bitboard, uint8_t square){ bitboard &= ~(1ULL << square); }
 
-void bit_clear(uint64_t& bitboard, int i, int j);
-void bit_clear(uint64_t& bitboard, unsigned long& square);
-void bit_clear_opt(uint64_t& bitboard, const uint8_t& square);
+BITBOARD_CONSTEXPR bool bit_get(uint64_t bitboard, int i, int j){ return (bitboard >> (8*i+j)) & 1; }
+BITBOARD_CONSTEXPR bool bit_get(uint64_t bitboard, unsigned long square){ return (bitboard >> square) & 1; }
+BITBOARD_CONSTEXPR bool bit_get_opt(uint64_t bitboard, uint8_t square){ return (bitboard >> square) & 1; }
 
-bool bit_get(uint64_t bitboard, int i, int j);
-bool bit_get(const uint64_t& bitboard, const unsigned long& square);
-bool bit_get_opt(const uint64_t& bitboard, const uint8_t& square);
+// set to 0 the last bit which is 1
+BITBOARD_CONSTEXPR void clear_last_active_bit(uint64_t& bitboard){
+#if defined(_MSC_VER) && !defined(__clang__) && defined(BACCALA_BIT_INSTRUCTIONS)
+    bitboard = _blsr_u64(bitboard);
+#else
+    bitboard &= bitboard - 1; // blsr with -mbmi
+#endif
+}
 
-void clear_last_active_bit(uint64_t& bitboard); // set to 0 the last bit which is 1
+// square of the last / first bit which is 1 (the bitboard must not be empty)
+BITBOARD_CONSTEXPR unsigned long get_last_active_bit(uint64_t bitboard){
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long square;
+    _BitScanForward64(&square, bitboard);
+    return square;
+#else
+    return (unsigned long)__builtin_ctzll(bitboard);
+#endif
+}
+BITBOARD_CONSTEXPR unsigned long get_first_active_bit(uint64_t bitboard){
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long square;
+    _BitScanReverse64(&square, bitboard);
+    return square;
+#else
+    return 63UL - (unsigned long)__builtin_clzll(bitboard);
+#endif
+}
 
-size_t pop_count(uint64_t& bitboard); // count the number of 1 in the binary representation of bitboard
+// count the number of 1 in the binary representation of bitboard
+BITBOARD_CONSTEXPR int pop_count(uint64_t bitboard){
+#if defined(_MSC_VER) && !defined(__clang__) && defined(BACCALA_BIT_INSTRUCTIONS)
+    return (int)__popcnt64(bitboard);
+#elif !(defined(_MSC_VER) && !defined(__clang__)) && defined(__POPCNT__)
+    return __builtin_popcountll(bitboard);
+#else
+    // without POPCNT: add the bits in pairs, then in groups of 4 and 8, and sum the 8 bytes with a multiplication
+    bitboard = bitboard - ((bitboard >> 1) & 0x5555555555555555ULL);
+    bitboard = (bitboard & 0x3333333333333333ULL) + ((bitboard >> 2) & 0x3333333333333333ULL);
+    bitboard = (bitboard + (bitboard >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((bitboard * 0x0101010101010101ULL) >> 56);
+#endif
+}
 
 void PrintBitboard(uint64_t bitboard);
 
@@ -76,16 +162,16 @@ void PrintBitboard(uint64_t bitboard);
 const char pieces_white_pawn_becomes[4] = {'Q', 'R', 'B', 'N'};
 const char pieces_black_pawn_becomes[4] = {'q', 'r', 'b', 'n'};
 // pieces deltas
-const int knight_deltas[8][2] = {
+constexpr int knight_deltas[8][2] = {
     {1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}
 };
-const int king_deltas[8][2] = {
+constexpr int king_deltas[8][2] = {
     {1, 1}, {0, 1}, {-1, 1}, {1, 0}, {-1, 0}, {1, -1}, {0, -1}, {-1, -1}
 };
-const int white_pawn_deltas[2][2] = {
+constexpr int white_pawn_deltas[2][2] = {
     {-1, 1}, {-1, -1}
 };
-const int black_pawn_deltas[2][2] = {
+constexpr int black_pawn_deltas[2][2] = {
     {1, 1}, {1, -1}
 };
 
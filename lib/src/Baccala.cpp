@@ -4,8 +4,13 @@
 #include <Position.h>
 #include <Utilities.h>
 #include <TranspositionTable.h>
+#include <MovePicker.h>
+#include <Bitboards.h>
 #include <algorithm>
 #include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 
 void ScoreAllMoves(MoveAndPosition* moves, uint8_t n_moves){
@@ -32,10 +37,10 @@ void PickBestMove(MoveAndPosition* moves, uint8_t n_moves, int i){
 bool SafeNullMoveSearch(Position& pos){
     // if the side to move is in check, it is NOT safe to skip a move
     if(pos.white_to_move){
-        if((pos.pieces[0] & pos.black_covered_squares) != 0){ return false; }
+        if((pos.pieces[0] & CoveredSquares<BLACK>(pos)) != 0){ return false; }
     }
     else{
-        if((pos.pieces[6] & pos.white_covered_squares) != 0){ return false; }
+        if((pos.pieces[6] & CoveredSquares<WHITE>(pos)) != 0){ return false; }
     }
     // if very few pieces are remaining (<= 6) avoid it
     if(pop_count(pos.all_pieces) <= 6){ return false; }
@@ -50,10 +55,15 @@ bool SafeNullMoveSearch(Position& pos){
     return true;
 }
 
-unsigned long long int Perft(Position pos, int depth){
+unsigned long long int Perft(Position pos, int depth, bool bulk_counting){
     unsigned long long int n_nodes = 0;
     
     if(depth == 0){ return 1ULL; }
+    // bulk counting: the number of leaves is the number of legal moves, no need to build the children
+    if(bulk_counting && depth == 1){
+        MoveNew moves[MAX_NUMBER_OF_MOVES];
+        return LegalMovesNew(pos, moves);
+    }
 
     // generate legal moves
     MoveAndPosition m;
@@ -63,13 +73,13 @@ unsigned long long int Perft(Position pos, int depth){
 
     for(int move_index = 0; move_index < n_moves; move_index++){
         m = legal_moves[move_index];
-        n_nodes += Perft(m.position, depth - 1);
+        n_nodes += Perft(m.position, depth - 1, bulk_counting);
     }
 
     return n_nodes;
 }
 
-unsigned long long int PerftNew(Position pos, int depth, StateMemory state){
+unsigned long long int PerftNew(Position& pos, int depth, UndoStack& undo, bool bulk_counting){
     if(depth == 0){ return 1ULL; }
 
     unsigned long long int n_nodes = 0;
@@ -84,18 +94,79 @@ unsigned long long int PerftNew(Position pos, int depth, StateMemory state){
     for(int move_index = 0; move_index < MAX_NUMBER_OF_MOVES; move_index++){
         //move = moves[move_index];
         if(moves[move_index] == 0){ break; }
-        MakeMove(pos, moves[move_index], state);
+        MakeMove(pos, moves[move_index], undo);
         if(IsLegal(pos, moves[move_index])){
-            n_nodes += PerftNew(pos, depth - 1, state);
+            // bulk counting: every legal move is a leaf, don't go one ply deeper
+            n_nodes += (bulk_counting && depth == 1) ? 1ULL : PerftNew(pos, depth - 1, undo, bulk_counting);
         }
         //std::cout << "\t"; PrintMoveNew(move);
-        UnmakeMove(pos, moves[move_index], state);
+        UnmakeMove(pos, moves[move_index], undo);
+    }
+
+    return n_nodes;
+}
+
+unsigned long long int PerftLegal(Position& pos, int depth, UndoStack& undo, bool bulk_counting){
+    if(depth == 0){ return 1ULL; }
+
+    unsigned long long int n_nodes = 0;
+
+    // generate legal moves: no need to check legality after making the move
+    MoveNew moves[MAX_NUMBER_OF_MOVES];
+    uint8_t n_moves = LegalMovesNew(pos, moves);
+    // bulk counting: the number of leaves is the number of legal moves
+    if(bulk_counting && depth == 1){ return n_moves; }
+
+    for(int move_index = 0; move_index < n_moves; move_index++){
+        MakeMove(pos, moves[move_index], undo);
+        n_nodes += PerftLegal(pos, depth - 1, undo, bulk_counting);
+        UnmakeMove(pos, moves[move_index], undo);
     }
 
     return n_nodes;
 }
 
-void PerftTesting(){
+// print whether the perft result is correct, together with the speed of the move generator in nodes per second
+static void PrintPerftResult(unsigned long long int n_nodes, unsigned long long int expected_n_nodes, std::chrono::steady_clock::time_point begin){
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    long long int time = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+    std::cout << (n_nodes == expected_n_nodes) << "  (" << n_nodes << " nodes in " << time / 1000 << " ms, ";
+    std::cout << (time > 0 ? n_nodes * 1000000ULL / time : 0ULL) << " nodes/s)\n";
+}
+
+void PerftTesting(bool bulk_counting){
+    std::string pos1_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+    std::string pos2_fen = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 0";
+    std::string pos3_fen = "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1";
+    std::string pos4_fen = "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1";
+    std::string pos5_fen = "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8";
+    std::string pos6_fen = "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10";
+    Position pos1 = PositionFromFen(pos1_fen);
+    Position pos2 = PositionFromFen(pos2_fen);
+    Position pos3 = PositionFromFen(pos3_fen);
+    Position pos4 = PositionFromFen(pos4_fen);
+    Position pos5 = PositionFromFen(pos5_fen);
+    Position pos6 = PositionFromFen(pos6_fen);
+
+    int depth = 5;
+    std::chrono::steady_clock::time_point begin;
+    std::cout << "Performing Perft test at depth " << depth << (bulk_counting ? " (bulk counting)" : "") << ".\n 1 = ok; 0 = not ok.";
+    std::cout << (bulk_counting ? "\n" : " The test can take a few minutes...\n");
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 1: "; PrintPerftResult(Perft(pos1, depth, bulk_counting), 4865609, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 2: "; PrintPerftResult(Perft(pos2, depth, bulk_counting), 193690690, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 3: "; PrintPerftResult(Perft(pos3, depth, bulk_counting), 674624, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 4: "; PrintPerftResult(Perft(pos4, depth, bulk_counting), 15833292, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 5: "; PrintPerftResult(Perft(pos5, depth, bulk_counting), 89941194, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 6: "; PrintPerftResult(Perft(pos6, depth, bulk_counting), 164075551, begin);
+}
+
+void PerftNewTesting(bool bulk_counting){
     std::string pos1_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
     std::string pos2_fen = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 0";
     std::string pos3_fen = "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1";
@@ -110,16 +181,25 @@ void PerftTesting(){
     Position pos6 = PositionFromFen(pos6_fen);
 
     int depth = 5;
-    std::cout << "Performing Perft test at depth " << depth << ".\n 1 = ok; 0 = not ok. The test can take a few minutes...\n";
-    std::cout << "Testing position 1: "; std::cout << (Perft(pos1, depth) == 4865609) << "\n";
-    std::cout << "Testing position 2: "; std::cout << (Perft(pos2, depth) == 193690690) << "\n";
-    std::cout << "Testing position 3: "; std::cout << (Perft(pos3, depth) == 674624) << "\n";
-    std::cout << "Testing position 4: "; std::cout << (Perft(pos4, depth) == 15833292) << "\n";
-    std::cout << "Testing position 5: "; std::cout << (Perft(pos5, depth) == 89941194) << "\n";
-    std::cout << "Testing position 6: "; std::cout << (Perft(pos6, depth) == 164075551) << "\n";
+    UndoStack undo;
+    std::chrono::steady_clock::time_point begin;
+    std::cout << "Performing Perft test at depth " << depth << (bulk_counting ? " (bulk counting)" : "") << ".\n 1 = ok; 0 = not ok.";
+    std::cout << (bulk_counting ? "\n" : " The test can take a few minutes...\n");
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 1: "; PrintPerftResult(PerftNew(pos1, depth, undo, bulk_counting), 4865609, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 2: "; PrintPerftResult(PerftNew(pos2, depth, undo, bulk_counting), 193690690, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 3: "; PrintPerftResult(PerftNew(pos3, depth, undo, bulk_counting), 674624, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 4: "; PrintPerftResult(PerftNew(pos4, depth, undo, bulk_counting), 15833292, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 5: "; PrintPerftResult(PerftNew(pos5, depth, undo, bulk_counting), 89941194, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 6: "; PrintPerftResult(PerftNew(pos6, depth, undo, bulk_counting), 164075551, begin);
 }
 
-void PerftNewTesting(){
+void PerftLegalTesting(bool bulk_counting){
     std::string pos1_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
     std::string pos2_fen = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 0";
     std::string pos3_fen = "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1";
@@ -134,26 +214,145 @@ void PerftNewTesting(){
     Position pos6 = PositionFromFen(pos6_fen);
 
     int depth = 5;
-    StateMemory state;
-    std::cout << "Performing Perft test at depth " << depth << ".\n 1 = ok; 0 = not ok. The test can take a few minutes...\n";
-    std::cout << "Testing position 1: "; std::cout << (PerftNew(pos1, depth, state) == 4865609) << "\n";
-    std::cout << "Testing position 2: "; std::cout << (PerftNew(pos2, depth, state) == 193690690) << "\n";
-    std::cout << "Testing position 3: "; std::cout << (PerftNew(pos3, depth, state) == 674624) << "\n";
-    std::cout << "Testing position 4: "; std::cout << (PerftNew(pos4, depth, state) == 15833292) << "\n";
-    std::cout << "Testing position 5: "; std::cout << (PerftNew(pos5, depth, state) == 89941194) << "\n";
-    std::cout << "Testing position 6: "; std::cout << (PerftNew(pos6, depth, state) == 164075551) << "\n";
+    UndoStack undo;
+    std::chrono::steady_clock::time_point begin;
+    std::cout << "Performing Perft test at depth " << depth << (bulk_counting ? " (bulk counting)" : "") << ".\n 1 = ok; 0 = not ok.";
+    std::cout << (bulk_counting ? "\n" : " The test can take a few minutes...\n");
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 1: "; PrintPerftResult(PerftLegal(pos1, depth, undo, bulk_counting), 4865609, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 2: "; PrintPerftResult(PerftLegal(pos2, depth, undo, bulk_counting), 193690690, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 3: "; PrintPerftResult(PerftLegal(pos3, depth, undo, bulk_counting), 674624, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 4: "; PrintPerftResult(PerftLegal(pos4, depth, undo, bulk_counting), 15833292, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 5: "; PrintPerftResult(PerftLegal(pos5, depth, undo, bulk_counting), 89941194, begin);
+    begin = std::chrono::steady_clock::now();
+    std::cout << "Testing position 6: "; PrintPerftResult(PerftLegal(pos6, depth, undo, bulk_counting), 164075551, begin);
 }
 
+void CoveredSquaresBenchmark(){
+    std::string fens[6] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 0",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10"
+    };
+    Position positions[6];
+    for(int i = 0; i < 6; i++){ positions[i] = PositionFromFen(fens[i]); }
+    const bool has_avx2 = cpu_has_avx2();
 
-int BestEvaluation(Position& pos, int anti_depth, int alpha, int beta, int& n_explored_positions, bool can_do_null){
+    // first check that all the implementations agree
+    bool ok = true;
+    for(int i = 0; i < 6; i++){
+        uint64_t white_magic = GetCoveredSquaresLookup<WHITE>(positions[i].pieces, positions[i].all_pieces);
+        uint64_t black_magic = GetCoveredSquaresLookup<BLACK>(positions[i].pieces, positions[i].all_pieces);
+        ok &= (white_magic == GetCoveredSquaresSetwise<WHITE>(positions[i].pieces, positions[i].all_pieces, false));
+        ok &= (black_magic == GetCoveredSquaresSetwise<BLACK>(positions[i].pieces, positions[i].all_pieces, false));
+        if(has_avx2){
+            ok &= (white_magic == GetCoveredSquaresSetwise<WHITE>(positions[i].pieces, positions[i].all_pieces, true));
+            ok &= (black_magic == GetCoveredSquaresSetwise<BLACK>(positions[i].pieces, positions[i].all_pieces, true));
+        }
+    }
+    std::cout << "Covered squares: magic, Kogge-Stone and AVX2 Kogge-Stone agree: " << ok << "\n";
+
+    // then time 2 million calls per position and color for each implementation
+    const int n_iterations = 2000000;
+    uint64_t sink = 0;
+    for(int method = 0; method < 3; method++){
+        if(method == 2 && !has_avx2){ std::cout << "AVX2 not available on this CPU\n"; break; }
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        for(int iteration = 0; iteration < n_iterations; iteration++){
+            for(int i = 0; i < 6; i++){
+                // the occupancy changes with the iteration, so the calls cannot be hoisted out of the loop
+                uint64_t all_pieces = positions[i].all_pieces ^ (sink & 1);
+                if(method == 0){
+                    sink += GetCoveredSquaresLookup<WHITE>(positions[i].pieces, all_pieces) + GetCoveredSquaresLookup<BLACK>(positions[i].pieces, all_pieces);
+                }
+                else{
+                    sink += GetCoveredSquaresSetwise<WHITE>(positions[i].pieces, all_pieces, method == 2) + GetCoveredSquaresSetwise<BLACK>(positions[i].pieces, all_pieces, method == 2);
+                }
+            }
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        long long int time = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+        const char* names[3] = {"magic lookup:        ", "Kogge-Stone (scalar):", "Kogge-Stone (AVX2):  "};
+        std::cout << names[method] << " " << time / 1000 << " ms, ";
+        std::cout << (time > 0 ? 12ULL * n_iterations * 1000ULL / time : 0ULL) << " calls/ms\n";
+    }
+    std::cout << "(checksum " << sink << ")\n";
+}
+
+void SlidersBackendBenchmark(){
+    std::string fen = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 0";
+    const int depth = 4;
+    const int n_threads_list[3] = {1, 8, 32};
+    const SlidersBackend backends[3] = {MAGIC_BACKEND, PEXT_BACKEND, OBSTRUCTION_DIFFERENCE_BACKEND};
+    const char* names[3] = {"magic:                ", "PEXT:                 ", "obstruction difference:"};
+    SlidersBackend initial_backend = sliders_backend;
+    std::cout << "Legal perft at depth " << depth << " in every thread (" << std::thread::hardware_concurrency() << " hardware threads)\n";
+    for(int b = 0; b < 3; b++){
+        if(backends[b] == PEXT_BACKEND && !cpu_has_fast_pext()){ std::cout << names[b] << " not available on this CPU\n"; continue; }
+        set_sliders_backend(backends[b]);
+        std::cout << names[b];
+        for(int n_threads : n_threads_list){
+            // every thread works on its own copy of the position, with its own undo stack
+            std::vector<unsigned long long int> n_nodes(n_threads, 0);
+            std::vector<std::thread> threads;
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            for(int t = 0; t < n_threads; t++){
+                threads.emplace_back([&n_nodes, &fen, t](){
+                    Position pos = PositionFromFen(fen);
+                    UndoStack undo;
+                    n_nodes[t] = PerftLegal(pos, depth, undo, true);
+                });
+            }
+            for(std::thread& thread : threads){ thread.join(); }
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            long long int time = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+            unsigned long long int total = 0;
+            for(unsigned long long int n : n_nodes){ total += n; }
+            std::cout << "  " << n_threads << " threads: " << (time > 0 ? total * 1000000ULL / time : 0ULL) << " nodes/s";
+        }
+        std::cout << "\n";
+    }
+    set_sliders_backend(initial_backend);
+}
+
+
+// score of a position where the side to move has no legal moves, from its point of view: draw if stalemate, otherwise checkmate
+template<Color Us>
+static int NoLegalMovesScore(const Position& pos, int anti_depth){
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    const uint64_t enemy_covered_squares = CoveredSquares<~Us>(pos);
+    // STALEMATED: the king is NOT in the opponent's covered squares
+    if((enemy_covered_squares & pos.pieces[friendly]) == 0){
+        return 0; // it's a draw
+    }
+    // CHECKMATED: adding the depth is used to consider a mate in 1 better than a mate in 2 or in 3 etc
+    return -100000 - anti_depth;
+}
+
+// The search is a template on the side to move (Us): the color is dispatched once in BestEvaluation,
+// then every node calls the move generation and make / unmake specialized for its color,
+// and the recursion switches to the specialization of the opponent (~Us).
+// NEGAMAX: scores, alpha and beta are from the point of view of the side to move (see Baccala.h),
+// so the score of a child is the opposite of its own score and the window is flipped: [-beta, -alpha]
+template<Color Us>
+static int Search(Position& pos, UndoStack& undo, int anti_depth, int alpha, int beta, int& n_explored_positions, bool can_do_null){
     // ------------------------------------------------------
     // ----- RETRIEVE SCORE FROM TRANSPOSITION TABLE --------
     // ------------------------------------------------------
-    // compute Zobrist key for the current position
-    uint64_t zobrist_key = ZobristHashing(pos);
+    // Zobrist key of the current position (kept up to date incrementally while generating the moves)
+    uint64_t zobrist_key = pos.hash;
     // check if the move is already present in the transposition table:
     // if yes return a pointer to its memory address; if no return nullptr
     TTEntry* entry = TTProbe(zobrist_key);
+    // best move found when the position was analyzed before: it is searched first even if the depth was not enough
+    MoveNew hash_move = entry ? entry->best_move : 0;
     // if the position is store and it has been analyzed better than what we are about to do here
     // then just return the already found score
     if(entry && entry->depth >= anti_depth){
@@ -174,37 +373,19 @@ int BestEvaluation(Position& pos, int anti_depth, int alpha, int beta, int& n_ex
     if(pos.half_move_counter >= 50){
         return 0;
     }
-    // limit case: at anti_depth = 0 just return the material value of the input position
+    // limit case: at anti_depth = 0 just return the material value of the input position (PositionScore is for white),
+    // unless it is checkmate or stalemate (HasLegalMove stops at the first legal move, nothing is generated)
     if(anti_depth == 0){
-        return PositionScore(pos);
+        if(!HasLegalMove<Us>(pos)){ return NoLegalMovesScore<Us>(pos, anti_depth); }
+        return (Us == WHITE) ? PositionScore(pos) : -PositionScore(pos);
     }
-    // else generate all the new positions applying all the legal moves 
+    // else apply the legal moves one at a time (the move picker generates them lazily, in stages)
     // then recursively call this function and update best_evaluation if needed
     int eval, best_evaluation;
-    MoveAndPosition move_and_pos;
-    MoveAndPosition legal_moves[MAX_NUMBER_OF_MOVES];
-    LegalMoves(pos, legal_moves);
-    uint8_t n_moves = pos.n_legal_moves;
-    // manage stalemate and checkmate: no legal moves in the current position
-    if(n_moves == 0){
-        if(pos.white_to_move){
-            // BLACK STALEMATED: white to move and the white king is NOT in black's covered squares 
-            if((pos.black_covered_squares & pos.pieces[0]) == 0){
-                return 0; // it's a draw
-            }
-            // BLACK CHECKMATED
-            else{ return -100000 - anti_depth; }
-        }
-        else{
-            // WHITE STALEMATED: black to move and the black king is NOT in white's covered squares 
-            if((pos.white_covered_squares & pos.pieces[6]) == 0){
-                return 0; // it's a draw
-            }
-            // WHITE CHECKMATED: black to move and the black king is in check
-            else{ return 100000 + anti_depth; } // adding the depth is used to consider a mate in 1 better than a mate in 2 or in 3 etc
-        }
-    }
-    pos.white_to_move ? best_evaluation = negative_infinity : best_evaluation = positive_infinity;
+    MoveNew move, best_move = 0;
+    int n_moves = 0;
+    // not negative_infinity: it cannot be negated
+    best_evaluation = -positive_infinity;
 
     // ---------------------------------
     // ------ NULL MOVE PRUNING --------
@@ -219,7 +400,7 @@ int BestEvaluation(Position& pos, int anti_depth, int alpha, int beta, int& n_ex
                 new_pos.en_passant_target_square = 0;
                 // launch a shallow evaluation function with no rights of making null move
                 // the evaluation is 2 plies shorter than a normal search
-                eval = -BestEvaluation(new_pos, anti_depth - r, -beta, -beta + 1, n_explored_positions, false);
+                eval = -BestEvaluation(new_pos, undo, anti_depth - r, -beta, -beta + 1, n_explored_positions, false);
             }
             else{
                 // make null move
@@ -228,40 +409,41 @@ int BestEvaluation(Position& pos, int anti_depth, int alpha, int beta, int& n_ex
                 new_pos.en_passant_target_square = 0;
                 // launch a shallow evaluation function with no rights of making null move
                 // the evaluation is 2 plies shorter than a normal search
-                eval = -BestEvaluation(new_pos, anti_depth - r, -beta, -beta+1, n_explored_positions, false);
+                eval = -BestEvaluation(new_pos, undo, anti_depth - r, -beta, -beta+1, n_explored_positions, false);
             }
             if(eval >= beta){ return eval; }
         }
     } */
 
-    // ---------------------------------------------------------
-    // ------ MIN - MAX SEARCH WITH ALPHA - BETA PRUNING -------
-    // ---------------------------------------------------------
-    int original_alpha = alpha, original_beta = beta;
-    // Loop through the legal moves to assign a heuristic score
-    ScoreAllMoves(legal_moves, n_moves);
-    // Loop again to recursively iterate the function 
-    for(int move_index = 0; move_index < n_moves; move_index++){
-        // pick the best move in the range [move_index + 1, n_moves] and bring it to the current index
-        PickBestMove(legal_moves, n_moves, move_index);
-        move_and_pos = legal_moves[move_index];
-        // white to move
-        if(pos.white_to_move){
-            eval = BestEvaluation(move_and_pos.position, anti_depth - 1, alpha, beta, n_explored_positions, true);
-            best_evaluation = std::max(best_evaluation, eval);
-            if(best_evaluation >= 100000){ break; }
-            alpha = std::max(alpha, eval); // best evaluation for white encountered so far down the tree
-            if(beta <= alpha){ break; } 
+    // ---------------------------------------------
+    // ------ PRINCIPAL VARIATION SEARCH (PVS) -------
+    // ---------------------------------------------
+    int original_alpha = alpha;
+    // hash move, captures, killers, quiet moves: in most cut-nodes the quiet moves are never generated
+    MovePicker picker(pos, hash_move, undo.ply);
+    while((move = picker.NextMove()) != 0){
+        n_moves++;
+        MakeMove<Us>(pos, move, undo);
+        // the first move is expected to be the best one (move ordering): it's searched with the full window
+        if(n_moves == 1){
+            eval = -Search<~Us>(pos, undo, anti_depth - 1, -beta, -alpha, n_explored_positions, true);
         }
-        // black to move
+        // the other moves only need to be proven worse than alpha: a null window [alpha, alpha + 1] is enough and cuts much more.
+        // If one of them fails high, it can be the new best move: search it again with the full window to know its score
         else{
-            eval = BestEvaluation(move_and_pos.position, anti_depth - 1, alpha, beta, n_explored_positions, true);
-            best_evaluation = std::min(best_evaluation, eval);
-            if(best_evaluation <= -100000){ break; }
-            beta = std::min(beta, eval);
-            if(beta <= alpha){ break; }
+            eval = -Search<~Us>(pos, undo, anti_depth - 1, -alpha - 1, -alpha, n_explored_positions, true);
+            if(eval > alpha && eval < beta){
+                eval = -Search<~Us>(pos, undo, anti_depth - 1, -beta, -alpha, n_explored_positions, true);
+            }
         }
+        UnmakeMove<Us>(pos, move, undo);
+        if(eval > best_evaluation){ best_evaluation = eval; best_move = move; }
+        if(best_evaluation >= 100000){ break; }
+        alpha = std::max(alpha, eval);
+        if(alpha >= beta){ StoreKillerMove(move, undo.ply); break; }
     }
+    // manage stalemate and checkmate: no legal moves in the current position
+    if(n_moves == 0){ return NoLegalMovesScore<Us>(pos, anti_depth); }
 
     // --------------------------------------------------------
     // ------ STORE POSITION IN THE TRANSPOSITION TABLE -------
@@ -269,15 +451,24 @@ int BestEvaluation(Position& pos, int anti_depth, int alpha, int beta, int& n_ex
     NodeFlag flag;
     if (best_evaluation <= original_alpha)
         flag = UPPERBOUND;
-    else if (best_evaluation >= original_beta)
+    else if (best_evaluation >= beta)
         flag = LOWERBOUND;
     else
         flag = EXACT;
-    TTStore(anti_depth, zobrist_key, best_evaluation, flag);
+    TTStore(anti_depth, zobrist_key, best_evaluation, flag, best_move);
 
     return best_evaluation;
 }
 
+int BestEvaluation(Position& pos, UndoStack& undo, int anti_depth, int alpha, int beta, int& n_explored_positions, bool can_do_null){
+    // the window is from white's point of view: for black it is flipped, and so is the result.
+    // negative_infinity cannot be negated: clamp it to -positive_infinity
+    alpha = std::max(alpha, -positive_infinity);
+    beta = std::max(beta, -positive_infinity);
+    return pos.white_to_move ? Search<WHITE>(pos, undo, anti_depth, alpha, beta, n_explored_positions, can_do_null)
+                             : -Search<BLACK>(pos, undo, anti_depth, -beta, -alpha, n_explored_positions, can_do_null);
+}
+
 
 MoveAndPosition BestMove(Position pos, int depth){
     // initialize stuff
@@ -295,6 +486,9 @@ MoveAndPosition BestMove(Position pos, int depth){
     LegalMoves(pos, legal_moves);
     uint8_t n_moves = pos.n_legal_moves;
     best_move = legal_moves[0];
+    // the search below the root makes and unmakes the moves on the child positions
+    UndoStack undo;
+    ClearKillerMoves();
     // Loop through the legal moves to assign a heuristic score
     ScoreAllMoves(legal_moves, n_moves);
     // initialize the hash-map for the Transposition table
@@ -307,7 +501,7 @@ MoveAndPosition BestMove(Position pos, int depth){
         m = legal_moves[move_index];
         //std::cout << "depth: " << depth << " ; move: "; PrintMove(m.move);
         // generate child position and find its best evaluation down the tree 
-        eval = BestEvaluation(m.position, depth-1, negative_infinity, positive_infinity, /*TranspositionTable,*/ n_explored_positions, true); // depth-1 because we are rooting from the child position
+        eval = BestEvaluation(m.position, undo, depth-1, negative_infinity, positive_infinity, /*TranspositionTable,*/ n_explored_positions, true); // depth-1 because we are rooting from the child position
         //std::cout << "eval: " << eval << "\n";
         // if white to move and the evaluation at given depth of this move is higher than all the previous ones, overwrite best move
         if(pos.white_to_move){
@@ -343,6 +537,9 @@ MoveAndPosition IterativeDeepening(Position& pos, int min_depth, int max_depth,
     LegalMoves(pos, legal_moves);
     uint8_t n_moves = pos.n_legal_moves;
     best_move = legal_moves[0];
+    // the search below the root makes and unmakes the moves on the child positions
+    UndoStack undo;
+    ClearKillerMoves();
     // Loop through the legal moves to assign a heuristic score
     ScoreAllMoves(legal_moves, n_moves);
     // initialize the hash-map for the Transposition table
@@ -365,7 +562,7 @@ MoveAndPosition IterativeDeepening(Position& pos, int min_depth, int max_depth,
             m = legal_moves[move_index];
             std::cout << "move: "; PrintMove(m.move);
             // generate child position and find its best evaluation down the tree 
-            eval = BestEvaluation(m.position, depth-1, negative_infinity, positive_infinity, /*TranspositionTable,*/ n_explored_positions, true); // depth-1 because we are rooting from the child position
+            eval = BestEvaluation(m.position, undo, depth-1, negative_infinity, positive_infinity, /*TranspositionTable,*/ n_explored_positions, true); // depth-1 because we are rooting from the child position
             std::cout << "eval: " << eval << "\n";
             // if white to move and the evaluation at given depth of this move is higher than all the previous ones, overwrite best move
             if(pos.white_to_move){
@@ -400,4 +597,4 @@ MoveAndPosition IterativeDeepening(Position& pos, int min_depth, int max_depth,
         // if a forced mate is found, there's no need to search deeper 
     }
     return best_move;
-}
+}
\ No newline at end of file
@@ -1,141 +1,69 @@
 #include <Bitboards.h>
 #include <Utilities.h>
+#if defined(__x86_64__) || defined(_M_X64)
+#define BACCALA_X86_64
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
 #include <fstream>
+#include <cstdio>
+#include <vector>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
 
-uint64_t knight_covered_squares_bitboards[64]; 
-uint64_t king_covered_squares_bitboards[64];
-uint64_t white_pawn_covered_squares_bitboards[64];
-uint64_t black_pawn_covered_squares_bitboards[64];
-uint64_t white_pawn_advance_squares_bitboards[64];
-uint64_t black_pawn_advance_squares_bitboards[64];
+// the assets of the source tree (magic numbers): CMake compiles in their absolute path, so they don't depend on the working directory
+#ifndef BACCALA_ASSETS_DIR
+#define BACCALA_ASSETS_DIR "../assets"
+#endif
 
-uint64_t rook_masks[64];
-uint64_t rook_magics[64];
-uint64_t *rook_covered_squares_bitboards = nullptr;
+// magics found or read by the engine: the magic pointers point here, unless they point in the mapped file or in the embedded tables
+static uint64_t rook_magics_storage[64];
+static uint64_t bishop_magics_storage[64];
 
-uint64_t bishop_masks[64];
-uint64_t bishop_magics[64];
-uint64_t *bishop_covered_squares_bitboards = nullptr;
-
-uint64_t mask_white_passed_pawn[64];
-uint64_t mask_black_passed_pawn[64];
+const uint64_t *rook_magics = rook_magics_storage;
+int rook_n_bits[64];
+int rook_shifts[64];
+int rook_offsets[64];
+int rook_pext_offsets[64];
+int n_magic_attacks_rook = n_attacks_rook;
+const uint64_t *rook_covered_squares_bitboards = nullptr;
 
+const uint64_t *bishop_magics = bishop_magics_storage;
+int bishop_n_bits[64];
+int bishop_shifts[64];
+int bishop_offsets[64];
+int bishop_pext_offsets[64];
+int n_magic_attacks_bishop = n_attacks_bishop;
+const uint64_t *bishop_covered_squares_bitboards = nullptr;
 
-uint64_t knight_covered_squares(int i, int j){
-    uint64_t knight_bitboard = 0;
-    int i_target, j_target;
-    for(int d = 0; d < 8; d++){
-        i_target = i + knight_deltas[d][0]; 
-        if(i_target < 0 || i_target > 7){ continue; }
-        j_target = j + knight_deltas[d][1];
-        if(j_target < 0 || j_target > 7){ continue; }
-        bit_set(knight_bitboard, i_target, j_target);
-    }
-    return knight_bitboard;
-}
-
-uint64_t king_covered_squares(int i, int j){
-    uint64_t king_bitboard = 0;
-    int i_target, j_target;
-    for(int d = 0; d < 8; d++){
-        i_target = i + king_deltas[d][0]; 
-        if(i_target < 0 || i_target > 7){ continue; }
-        j_target = j + king_deltas[d][1];
-        if(j_target < 0 || j_target > 7){ continue; }
-        bit_set(king_bitboard, i_target, j_target);
-    }
-    return king_bitboard;
-}
-
-uint64_t white_pawn_covered_squares(int i, int j){
-    uint64_t white_pawn_bitboard = 0;
-    int i_target, j_target;
-    for(int d = 0; d < 2; d++){
-        i_target = i + white_pawn_deltas[d][0]; 
-        if(i_target < 0 || i_target > 7){ continue; }
-        j_target = j + white_pawn_deltas[d][1];
-        if(j_target < 0 || j_target > 7){ continue; }
-        bit_set(white_pawn_bitboard, i_target, j_target);
-    }
-    return white_pawn_bitboard;
-}
-
-uint64_t black_pawn_covered_squares(int i, int j){
-    uint64_t black_pawn_bitboard = 0;
-    int i_target, j_target;
-    for(int d = 0; d < 2; d++){
-        i_target = i + black_pawn_deltas[d][0]; 
-        if(i_target < 0 || i_target > 7){ continue; }
-        j_target = j + black_pawn_deltas[d][1];
-        if(j_target < 0 || j_target > 7){ continue; }
-        bit_set(black_pawn_bitboard, i_target, j_target);
-    }
-    return black_pawn_bitboard;
-}
-
-uint64_t white_pawn_advance_squares(int i, int j){
-    uint64_t white_pawn_bitboard = 0;
-    int i_target, j_target;
-    if(i != 0){
-        i_target = i - 1; j_target = j;
-        bit_set(white_pawn_bitboard, i_target, j_target);
-        if(i == 6){
-            i_target = i - 2; j_target = j;
-            bit_set(white_pawn_bitboard, i_target, j_target);
-        }
-    }
-    return white_pawn_bitboard;
-}
+// attack tables computed or copied by the engine: the table pointers point here, unless they point in the mapped file.
+// Their size is the one of the order they hold (see tables_size)
+static uint64_t *rook_tables_storage = nullptr;
+static uint64_t *bishop_tables_storage = nullptr;
+static int rook_tables_storage_size = 0;
+static int bishop_tables_storage_size = 0;
+static const uint64_t *mapped_tables_file = nullptr;
+static size_t mapped_tables_file_size = 0;
 
-uint64_t black_pawn_advance_squares(int i, int j){
-    uint64_t black_pawn_bitboard = 0;
-    int i_target, j_target;
-    if(i != 7){
-        i_target = i + 1; j_target = j;
-        bit_set(black_pawn_bitboard, i_target, j_target);
-        if(i == 1){
-            i_target = i + 2; j_target = j;
-            bit_set(black_pawn_bitboard, i_target, j_target);
-        }
-    }
-    return black_pawn_bitboard;
-}
+SlidersBackend sliders_backend = MAGIC_BACKEND;
+static SlidersBackend tables_order = MAGIC_BACKEND; // order of the attacks currently in the tables
+uint64_t line_lower_masks[64][4];
+uint64_t line_upper_masks[64][4];
+bool use_avx2 = false;
 
-uint64_t rook_relevant_blockers_mask(int i, int j){
-    uint64_t bitboard = 0ULL;
-    for(int j_target = 1; j_target < 7; j_target++){
-        if(j_target == j){ continue; }
-        bit_set(bitboard, i, j_target);
-    }
-    for(int i_target = 1; i_target < 7; i_target++){
-        if(i_target == i){ continue; }
-        bit_set(bitboard, i_target, j);
-    }
-    return bitboard;
-}
-
-uint64_t bishop_relevant_blockers_mask(int i, int j){
-    uint64_t bitboard = 0ULL;
-    int i_target, j_target;
-    for(int d = -6; d < 7; d++){
-        i_target = i + d;
-        j_target = j + d;
-        if(i_target < 1 || i_target > 6 || j_target < 1 || j_target > 6 ){ continue; }
-        else if(j_target == j || i_target == i) { continue; }
-        bit_set(bitboard, i_target, j_target);
-    }
-    for(int d = -6; d < 7; d++){
-        i_target = i + d;
-        j_target = j - d;
-        if(i_target < 1 || i_target > 6 || j_target < 1 || j_target > 6 ){ continue; }
-        else if(j_target == j || i_target == i) { continue; }
-        bit_set(bitboard, i_target, j_target);
-    } 
-    return bitboard;
-}
+uint64_t mask_white_passed_pawn[64];
+uint64_t mask_black_passed_pawn[64];
 
 
-// ----------- SLIDING PIECES ---------------
 uint64_t rook_covered_squares_from_blockers(uint64_t blockers, int i, int j){
     uint64_t bitboard = 0ULL;
     // bottom sliding
@@ -225,9 +153,9 @@ uint64_t bishop_blockers_from_integer(uint64_t b, int i, int j){
         std::cout << "Error. Trying to generate blockers from integer which is too large. Returning 0.\n";
         return blockers;
     }
-    // convert b into an array of relevant bits
-    bool *bits = new bool [b_max]; 
-    for(int index = 0; index < b_max; index++){
+    // convert b into an array of relevant bits (at most 9 for a bishop)
+    bool bits[9];
+    for(int index = 0; index < n_squares_for_bishop_blockers[8*i+j]; index++){
         bits[index] = bit_get(b, 0, index); // <--- trick to extract the first bits of b
     }
     // now rearrange the bits in the diagonal of the square (i, j), excluding the edge squares
@@ -260,311 +188,784 @@ uint64_t bishop_blockers_from_integer(uint64_t b, int i, int j){
         }
         index++;
     }
-    delete [] bits;
     return blockers;
 }
 
-void find_rook_magic(unsigned int n_bits, uint64_t *attacks, uint64_t magics[64]){
-    int shift = 64 - n_bits;
-    int n_attacks = IntPow(2, n_bits);
-    uint64_t magic, blockers, attack, stored_attack, hash_index;
-    int i, j;
+// all the configurations of the relevant blockers of a square and their attacks, computed once before trying the magic numbers.
+// Returns the number of configurations
+static int get_blockers_and_attacks(bool is_rook, int square, uint64_t *blockers, uint64_t *attacks){
+    const uint64_t mask = is_rook ? rook_masks[square] : bishop_masks[square];
+    int i = square / 8, j = square % 8, n_configurations = 0;
+    // loop over all the subsets of the mask (Carry-Rippler trick), starting from the empty one
+    uint64_t subset = 0ULL;
+    do{
+        blockers[n_configurations] = subset;
+        attacks[n_configurations] = is_rook ? rook_covered_squares_from_blockers(subset, i, j) : bishop_covered_squares_from_blockers(subset, i, j);
+        n_configurations++;
+        subset = (subset - mask) & mask;
+    } while(subset);
+    return n_configurations;
+}
+
+// try random magic numbers for one square until one works with the given number of bits, or until max_trials numbers are tried (0 = no limit).
+// Different blockers can share an index if they have the same attacks (constructive collisions):
+// this is what allows fewer bits than the relevant blockers in the densest search.
+// With fewer bits than the relevant blockers the sparse numbers (and the quick rejection) rarely work: with is_dense = true
+// the random numbers have 1/8, 1/4 or 1/2 of the bits set, in turn, and they are all tried.
+// On success, the attacks of the square are written in table (1 << n_bits numbers)
+static bool find_square_magic(const uint64_t *blockers, const uint64_t *attacks, int n_configurations, uint64_t mask, int n_bits, bool is_dense,
+                              uint64_t max_trials, std::mt19937_64& generator, uint64_t& magic, std::vector<uint64_t>& table){
+    const int shift = 64 - n_bits;
+    uint64_t hash_index, product;
     bool success;
-    // loop over the whole board
-    for(int square = 0; square < 64; square++){
-        i = square/8; j = square % 8;
-        std::cout << "Searching magics for square: (" << i << ", " << j << ")\t";
-        // loop until you find the good magic number
-        success = false;
-        while(!success){
-            // create random magic number (with many zero bits)
-            magic = rand64() & rand64();
-            // reset the attacks array with 111111... numbers
-            for(int index = 0; index < n_attacks; index++){
-                attacks[square * n_attacks + index] = -1;
+    table.assign(1ULL << n_bits, 0ULL);
+    // trial in which every index was written last: no need to reset the table after every failed magic number
+    std::vector<uint32_t> used_in_trial(1ULL << n_bits, 0);
+    for(uint32_t trial = 1; max_trials == 0 || trial <= max_trials; trial++){
+        // create random magic number (with many zero bits: with the minimum number of bits denser numbers almost never work)
+        magic = generator() & generator() & generator();
+        if(is_dense){
+            if(trial % 3 == 1){ magic |= generator() & generator(); }
+            else if(trial % 3 == 2){ magic = generator(); }
+        }
+        // quick rejection: the magic must bring enough relevant bits in the top byte, which is the first part of the index
+        product = (mask * magic) & 0xFF00000000000000ULL;
+        if(!is_dense && pop_count(product) < 6){ continue; }
+        success = true;
+        for(int configuration = 0; configuration < n_configurations; configuration++){
+            hash_index = (blockers[configuration] * magic) >> shift;
+            if(used_in_trial[hash_index] != trial){
+                used_in_trial[hash_index] = trial;
+                table[hash_index] = attacks[configuration];
             }
-            // loop over all the blockers
-            for(int b = 0; b < 4096; b++){
-                // generate bitboard of blockers corresponding to a given index
-                blockers = rook_blockers_from_integer(b, i, j);
-                // generate attack bitboard given the blockers configuration
-                attack = rook_covered_squares_from_blockers(blockers, i, j);
-                // generate hash index
-                hash_index = (blockers * magic) >> shift;
-                if(hash_index >= n_attacks){ std::cout << "Error!\n"; }
-                // check what is stored in the attacks array in correspodence to the hash index:
-                stored_attack = attacks[square * n_attacks + hash_index];
-                // if attack is stored, check for conflict and in case of conflict, change magic number
-                if(stored_attack != -1){
-                    if(stored_attack != attack){
-                        break; // by breaking the loop, the magic number is changed
-                    }
-                }
-                else{
-                    attacks[square * n_attacks + hash_index] = attack;
-                }
-                // if no conflict occured at the end of the inner loop, the search for magics was successful
-                if(b == 4095){
-                    success = true;
-                }
+            // conflict: two different attacks with the same index, change magic number
+            else if(table[hash_index] != attacks[configuration]){
+                success = false;
+                break;
             }
         }
-        std::cout << " Found the number " << magic << "\n";
-        magics[square] = magic;
+        if(success){ return true; }
     }
+    return false;
 }
 
-void find_bishop_magic(unsigned int n_bits, uint64_t *attacks, uint64_t magics[64]){
-    int shift = 64 - n_bits;
-    int n_attacks = IntPow(2, n_bits);
-    uint64_t magic, blockers, attack, stored_attack, hash_index;
-    int i, j;
-    int b_max;
-    bool success;
-    // loop over the whole board
+// every square has its own random generator: the magic numbers found don't depend on the number of threads
+static std::mt19937_64 magic_generator(bool is_rook, int square){
+    return std::mt19937_64(0x9E3779B97F4A7C15ULL * (2 * square + (is_rook ? 1 : 0) + 1));
+}
+
+static int magic_search_threads(int n_threads){
+    if(n_threads > 0){ return n_threads; }
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+// the squares are shared between the threads: every thread takes the next square to search as soon as it is free
+static void find_magics(bool is_rook, const int n_bits[64], const int offsets[64], uint64_t *attacks, uint64_t magics[64], int n_threads){
+    std::atomic<int> next_square(0);
+    double seconds[64];
+    auto search = [&](){
+        std::vector<uint64_t> blockers(4096), attacks_of_blockers(4096), table;
+        for(int square = next_square++; square < 64; square = next_square++){
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            const uint64_t mask = is_rook ? rook_masks[square] : bishop_masks[square];
+            int n_configurations = get_blockers_and_attacks(is_rook, square, blockers.data(), attacks_of_blockers.data());
+            std::mt19937_64 generator = magic_generator(is_rook, square);
+            find_square_magic(blockers.data(), attacks_of_blockers.data(), n_configurations, mask, n_bits[square], false, 0, generator, magics[square], table);
+            std::copy(table.begin(), table.end(), attacks + offsets[square]);
+            seconds[square] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        }
+    };
+    std::vector<std::thread> threads;
+    for(int thread_index = 0; thread_index < magic_search_threads(n_threads); thread_index++){
+        threads.emplace_back(search);
+    }
+    for(std::thread& thread : threads){ thread.join(); }
     for(int square = 0; square < 64; square++){
-        i = square/8; j = square % 8;
-        b_max = IntPow(2, n_squares_for_bishop_blockers[square]);
-        std::cout << "Searching magics for square: (" << i << ", " << j << ")\t";
-        // loop until you find the good magic number
-        success = false;
-        while(!success){
-            // create random magic number (with many zero bits)
-            magic = rand64() & rand64();
-            // reset the attacks array with 111111... numbers
-            for(int index = 0; index < n_attacks; index++){
-                attacks[square * n_attacks + index] = -1;
-            }
-            // loop over all the blockers
-            for(int b = 0; b < b_max; b++){
-                // generate bitboard of blockers corresponding to a given index
-                blockers = bishop_blockers_from_integer(b, i, j);
-                // generate attack bitboard given the blockers configuration
-                attack = bishop_covered_squares_from_blockers(blockers, i, j);
-                // generate hash index
-                hash_index = (blockers * magic) >> shift;
-                if(hash_index >= n_attacks){ std::cout << "Error!\n"; }
-                // check what is stored in the attacks array in correspodence to the hash index:
-                stored_attack = attacks[square * n_attacks + hash_index];
-                // if attack is stored, check for conflict and in case of conflict, change magic number
-                if(stored_attack != -1){
-                    if(stored_attack != attack){
-                        break; // by breaking the loop, the magic number is changed
-                    }
-                }
-                else{
-                    attacks[square * n_attacks + hash_index] = attack;
-                }
-                // if no conflict occured at the end of the inner loop, the search for magics was successful
-                if(b == b_max-1){
-                    success = true;
-                }
+        std::cout << "Magic for square: (" << square / 8 << ", " << square % 8 << ") with " << n_bits[square] << " bits\t"
+                  << magics[square] << "\tfound in " << seconds[square] * 1000 << " ms\n";
+    }
+}
+
+void find_rook_magic(const int n_bits[64], const int offsets[64], uint64_t *attacks, uint64_t magics[64], int n_threads){
+    find_magics(true, n_bits, offsets, attacks, magics, n_threads);
+}
+
+void find_bishop_magic(const int n_bits[64], const int offsets[64], uint64_t *attacks, uint64_t magics[64], int n_threads){
+    find_magics(false, n_bits, offsets, attacks, magics, n_threads);
+}
+
+// for every square, start from a magic number with as many bits as the relevant blockers and remove one bit at a time
+// while a magic number is found within max_trials
+static int find_densest_magics(bool is_rook, int n_bits[64], uint64_t magics[64], uint64_t max_trials, int n_threads){
+    std::atomic<int> next_square(0);
+    double seconds[64];
+    auto search = [&](){
+        std::vector<uint64_t> blockers(4096), attacks_of_blockers(4096), table;
+        uint64_t magic;
+        for(int square = next_square++; square < 64; square = next_square++){
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            uint64_t mask = is_rook ? rook_masks[square] : bishop_masks[square];
+            int n_configurations = get_blockers_and_attacks(is_rook, square, blockers.data(), attacks_of_blockers.data());
+            std::mt19937_64 generator = magic_generator(is_rook, square);
+            n_bits[square] = pop_count(mask);
+            find_square_magic(blockers.data(), attacks_of_blockers.data(), n_configurations, mask, n_bits[square], false, 0, generator, magics[square], table);
+            while(n_bits[square] > 1 && find_square_magic(blockers.data(), attacks_of_blockers.data(), n_configurations, mask, n_bits[square] - 1, true, max_trials, generator, magic, table)){
+                n_bits[square]--;
+                magics[square] = magic;
             }
+            seconds[square] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
         }
-        std::cout << " Found the number " << magic << "\n";
-        magics[square] = magic;
+    };
+    std::vector<std::thread> threads;
+    for(int thread_index = 0; thread_index < magic_search_threads(n_threads); thread_index++){
+        threads.emplace_back(search);
+    }
+    for(std::thread& thread : threads){ thread.join(); }
+    int n_attacks = 0, n_attacks_fancy = 0;
+    for(int square = 0; square < 64; square++){
+        uint64_t mask = is_rook ? rook_masks[square] : bishop_masks[square];
+        int relevant_bits = pop_count(mask);
+        n_attacks += 1 << n_bits[square];
+        n_attacks_fancy += 1 << relevant_bits;
+        std::cout << "Densest magic for square: (" << square / 8 << ", " << square % 8 << ") with " << n_bits[square] << " bits (instead of "
+                  << relevant_bits << ")\t" << magics[square] << "\tsearched in " << seconds[square] * 1000 << " ms\n";
     }
+    std::cout << (is_rook ? "Rook" : "Bishop") << " attacks: " << n_attacks << " bitboards instead of " << n_attacks_fancy << "\n";
+    return n_attacks;
 }
 
-uint64_t rook_hash_index(uint64_t blockers, int square, int n_attacks){
-    uint64_t mask = rook_masks[square]; 
-    uint64_t magic = rook_magics[square];
-    uint64_t hash_index = ((blockers & mask) * magic) >> shift_rook;
-    return (square * n_attacks + hash_index);
+int find_densest_rook_magics(int n_bits[64], uint64_t magics[64], uint64_t max_trials, int n_threads){
+    return find_densest_magics(true, n_bits, magics, max_trials, n_threads);
 }
 
-uint64_t bishop_hash_index(uint64_t blockers, int square, int n_attacks){
-    uint64_t mask = bishop_masks[square]; 
-    uint64_t magic = bishop_magics[square];
-    uint64_t hash_index = ((blockers & mask) * magic) >> shift_bishop;
-    return (square * n_attacks + hash_index);
+int find_densest_bishop_magics(int n_bits[64], uint64_t magics[64], uint64_t max_trials, int n_threads){
+    return find_densest_magics(false, n_bits, magics, max_trials, n_threads);
 }
 
+// CPU FEATURES
+// The engine is compiled for any x86-64 CPU: the functions with PEXT and AVX2 are compiled for these instructions only
+// (target attribute with GCC / Clang, MSVC doesn't need it) and they are called only if CPUID says that the CPU has them.
+// On other architectures (BACCALA_X86_64 not defined) there is no CPUID: the CPU has neither of them,
+// PEXT is computed bit by bit (only if the PEXT backend is forced) and the AVX2 fill is the scalar one
+#ifndef BACCALA_X86_64
+#define BACCALA_TARGET(instructions)
+#elif defined(_MSC_VER) && !defined(__clang__)
+#define BACCALA_TARGET(instructions)
+#else
+#define BACCALA_TARGET(instructions) __attribute__((target(instructions)))
+#endif
 
-void PreComputeBitboards(bool retrieve_from_file){
-    uint64_t bitboard;
-    int i, j;
-    // dynamic allocate attack arrays
-    int n_rook_attacks = IntPow(2, n_bits_rook);
-    int n_bishop_attacks = IntPow(2, n_bits_bishop);
-    rook_covered_squares_bitboards = new uint64_t[64 * n_rook_attacks];
-    bishop_covered_squares_bitboards = new uint64_t[64 * n_bishop_attacks];
-    // initialize covered squares for non sliding pieces:
+// registers EAX, EBX, ECX, EDX of the CPUID instruction for the given leaf and sub-leaf (all 0 if the leaf is not supported)
+static void cpuid(int info[4], int leaf, int subleaf){
+#ifndef BACCALA_X86_64
+    (void)leaf; (void)subleaf;
+    info[0] = info[1] = info[2] = info[3] = 0;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    __cpuidex(info, leaf, subleaf);
+#else
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __get_cpuid_count(leaf, subleaf, &eax, &ebx, &ecx, &edx);
+    info[0] = (int)eax; info[1] = (int)ebx; info[2] = (int)ecx; info[3] = (int)edx;
+#endif
+}
+
+BACCALA_TARGET("bmi2") static inline uint64_t pext(uint64_t blockers, uint64_t mask){
+#ifdef BACCALA_X86_64
+    return _pext_u64(blockers, mask);
+#else
+    // the bits of blockers under the mask, packed from the lowest one
+    uint64_t result = 0ULL;
+    for(uint64_t bit = 1ULL; mask; bit <<= 1){
+        if(blockers & mask & (0ULL - mask)){ result |= bit; }
+        mask &= mask - 1;
+    }
+    return result;
+#endif
+}
+
+uint64_t rook_hash_index(uint64_t blockers, int square){
+    if(sliders_backend == PEXT_BACKEND){
+        return rook_pext_offsets[square] + pext(blockers, rook_masks[square]);
+    }
+    uint64_t hash_index = ((blockers & rook_masks[square]) * rook_magics[square]) >> rook_shifts[square];
+    return rook_offsets[square] + hash_index;
+}
+
+uint64_t bishop_hash_index(uint64_t blockers, int square){
+    if(sliders_backend == PEXT_BACKEND){
+        return bishop_pext_offsets[square] + pext(blockers, bishop_masks[square]);
+    }
+    uint64_t hash_index = ((blockers & bishop_masks[square]) * bishop_magics[square]) >> bishop_shifts[square];
+    return bishop_offsets[square] + hash_index;
+}
+
+// attacks along one line (0 = file, 1 = rank, 2 = diagonal, 3 = anti-diagonal) with the obstruction difference
+static inline uint64_t line_attacks(uint64_t blockers, int square, int line){
+    unsigned long nearest_lower_blocker;
+    uint64_t lower = blockers & line_lower_masks[square][line];
+    uint64_t upper = blockers & line_upper_masks[square][line];
+    nearest_lower_blocker = get_first_active_bit(lower | 1ULL);
+    uint64_t difference = 2 * (upper & (0ULL - upper)) + (~0ULL << nearest_lower_blocker);
+    return (line_lower_masks[square][line] | line_upper_masks[square][line]) & difference;
+}
+
+uint64_t rook_attacks(uint64_t blockers, int square){
+    if(sliders_backend == OBSTRUCTION_DIFFERENCE_BACKEND){
+        return line_attacks(blockers, square, 0) | line_attacks(blockers, square, 1);
+    }
+    return rook_covered_squares_bitboards[rook_hash_index(blockers, square)];
+}
+
+uint64_t bishop_attacks(uint64_t blockers, int square){
+    if(sliders_backend == OBSTRUCTION_DIFFERENCE_BACKEND){
+        return line_attacks(blockers, square, 2) | line_attacks(blockers, square, 3);
+    }
+    return bishop_covered_squares_bitboards[bishop_hash_index(blockers, square)];
+}
+
+bool cpu_has_fast_pext(){
+    int info[4];
+    // leaf 0: highest supported leaf and vendor name (in EBX, EDX, ECX)
+    cpuid(info, 0, 0);
+    int max_leaf = info[0];
+    bool is_amd = (info[1] == 0x68747541); // "Auth"enticAMD
+    if(max_leaf < 7){ return false; }
+    // leaf 7, sub-leaf 0: EBX bit 8 = BMI2
+    cpuid(info, 7, 0);
+    if((info[1] & (1 << 8)) == 0){ return false; }
+    // AMD before Zen 3 (family 0x19) has a microcoded PEXT: the magics are faster
+    if(is_amd){
+        cpuid(info, 1, 0);
+        int family = (info[0] >> 8) & 0xF;
+        if(family == 0xF){ family += (info[0] >> 20) & 0xFF; }
+        if(family < 0x19){ return false; }
+    }
+    return true;
+}
+
+// position of the attacks of the blockers in the attack tables, in the order of the given table backend.
+// subset counts the blockers visited by the Carry-Rippler loop over the mask, which visits them in increasing order,
+// so subset = pext(blockers, mask): the PEXT order is written without the PEXT instruction (GenerateTables writes it on any CPU)
+static uint64_t rook_table_index(SlidersBackend backend, uint64_t blockers, int subset, int square){
+    if(backend == PEXT_BACKEND){ return rook_pext_offsets[square] + subset; }
+    return rook_offsets[square] + ((blockers * rook_magics[square]) >> rook_shifts[square]);
+}
+
+static uint64_t bishop_table_index(SlidersBackend backend, uint64_t blockers, int subset, int square){
+    if(backend == PEXT_BACKEND){ return bishop_pext_offsets[square] + subset; }
+    return bishop_offsets[square] + ((blockers * bishop_magics[square]) >> bishop_shifts[square]);
+}
+
+// number of attacks in the rook / bishop tables in the order of the given table backend
+static int tables_size(SlidersBackend backend, bool is_rook){
+    if(backend == PEXT_BACKEND){ return is_rook ? n_attacks_rook : n_attacks_bishop; }
+    return is_rook ? n_magic_attacks_rook : n_magic_attacks_bishop;
+}
+
+// allocate the attack tables for the given order (if they don't have the right size yet) and point the table pointers to them.
+// The new entries are zero: with the magic order some indexes are never used
+static void use_tables_storage(SlidersBackend order){
+    if(rook_tables_storage_size != tables_size(order, true) || bishop_tables_storage_size != tables_size(order, false)){
+        delete [] rook_tables_storage;
+        delete [] bishop_tables_storage;
+        rook_tables_storage_size = tables_size(order, true);
+        bishop_tables_storage_size = tables_size(order, false);
+        rook_tables_storage = new uint64_t[rook_tables_storage_size]();
+        bishop_tables_storage = new uint64_t[bishop_tables_storage_size]();
+    }
+    rook_covered_squares_bitboards = rook_tables_storage;
+    bishop_covered_squares_bitboards = bishop_tables_storage;
+}
+
+void fill_attack_tables(){
+    uint64_t blockers;
+    int i, j, subset;
+    use_tables_storage(MAGIC_BACKEND);
     for(int square = 0; square < 64; square++){
         i = square / 8; j = square % 8;
-        // knight bitboards
-        bitboard = knight_covered_squares(i,j);
-        knight_covered_squares_bitboards[square] = bitboard;
-        // king bitboards
-        bitboard = king_covered_squares(i,j);
-        king_covered_squares_bitboards[square] = bitboard;
-        // pawn bitboards
-        bitboard = white_pawn_covered_squares(i,j);
-        white_pawn_covered_squares_bitboards[square] = bitboard;
-        bitboard = white_pawn_advance_squares(i,j);
-        white_pawn_advance_squares_bitboards[square] = bitboard;
-        bitboard = black_pawn_covered_squares(i,j);
-        black_pawn_covered_squares_bitboards[square] = bitboard;
-        bitboard = black_pawn_advance_squares(i,j);
-        black_pawn_advance_squares_bitboards[square] = bitboard;
-        // masks of relevant bitboards
-        rook_masks[square] = rook_relevant_blockers_mask(i, j);
-        bishop_masks[square] = bishop_relevant_blockers_mask(i, j);
+        // loop over all the subsets of the mask (Carry-Rippler trick), starting from the empty one
+        blockers = 0ULL; subset = 0;
+        do{
+            rook_tables_storage[rook_table_index(MAGIC_BACKEND, blockers, subset++, square)] = rook_covered_squares_from_blockers(blockers, i, j);
+            blockers = (blockers - rook_masks[square]) & rook_masks[square];
+        } while(blockers);
+        blockers = 0ULL; subset = 0;
+        do{
+            bishop_tables_storage[bishop_table_index(MAGIC_BACKEND, blockers, subset++, square)] = bishop_covered_squares_from_blockers(blockers, i, j);
+            blockers = (blockers - bishop_masks[square]) & bishop_masks[square];
+        } while(blockers);
     }
+    tables_order = MAGIC_BACKEND;
+}
+
+void set_sliders_backend(SlidersBackend backend){
+    uint64_t blockers;
+    int subset;
+    sliders_backend = backend;
+    // the obstruction difference doesn't use the tables: they are left as they are, in case we switch back
+    if(backend == OBSTRUCTION_DIFFERENCE_BACKEND || backend == tables_order){ return; }
+    // the attacks are already in the tables in the order of the previous backend: move them to the new order,
+    // which is much faster than computing them again from the blockers
+    std::vector<uint64_t> old_rook_table(rook_covered_squares_bitboards, rook_covered_squares_bitboards + tables_size(tables_order, true));
+    std::vector<uint64_t> old_bishop_table(bishop_covered_squares_bitboards, bishop_covered_squares_bitboards + tables_size(tables_order, false));
+    // the mapped file is read-only: the new order goes in the engine's own tables (with the size of the new order)
+    use_tables_storage(backend);
+    for(int square = 0; square < 64; square++){
+        blockers = 0ULL; subset = 0;
+        do{
+            rook_tables_storage[rook_table_index(backend, blockers, subset, square)] = old_rook_table[rook_table_index(tables_order, blockers, subset, square)];
+            subset++;
+            blockers = (blockers - rook_masks[square]) & rook_masks[square];
+        } while(blockers);
+        blockers = 0ULL; subset = 0;
+        do{
+            bishop_tables_storage[bishop_table_index(backend, blockers, subset, square)] = old_bishop_table[bishop_table_index(tables_order, blockers, subset, square)];
+            subset++;
+            blockers = (blockers - bishop_masks[square]) & bishop_masks[square];
+        } while(blockers);
+    }
+    tables_order = backend;
+}
+
+void get_fancy_magic_n_bits(){
+    for(int square = 0; square < 64; square++){
+        rook_n_bits[square] = pop_count(rook_masks[square]);
+        bishop_n_bits[square] = pop_count(bishop_masks[square]);
+    }
+}
+
+// the attacks of every square start where the ones of the previous square end: returns the total size
+static int offsets_from_n_bits(const int n_bits[64], int offsets[64]){
+    int offset = 0;
+    for(int square = 0; square < 64; square++){
+        offsets[square] = offset;
+        offset += 1 << n_bits[square];
+    }
+    return offset;
+}
+
+void get_magic_offsets(){
+    int rook_fancy_n_bits[64], bishop_fancy_n_bits[64];
+    for(int square = 0; square < 64; square++){
+        rook_shifts[square] = 64 - rook_n_bits[square];
+        bishop_shifts[square] = 64 - bishop_n_bits[square];
+        rook_fancy_n_bits[square] = pop_count(rook_masks[square]);
+        bishop_fancy_n_bits[square] = pop_count(bishop_masks[square]);
+    }
+    n_magic_attacks_rook = offsets_from_n_bits(rook_n_bits, rook_offsets);
+    n_magic_attacks_bishop = offsets_from_n_bits(bishop_n_bits, bishop_offsets);
+    // PEXT: one bit per relevant blocker
+    offsets_from_n_bits(rook_fancy_n_bits, rook_pext_offsets);
+    offsets_from_n_bits(bishop_fancy_n_bits, bishop_pext_offsets);
+}
+
+// FNV-1a on 64-bit words: enough to detect a truncated or corrupted file
+static uint64_t tables_checksum(uint64_t checksum, const uint64_t* arr, size_t size){
+    for(size_t index = 0; index < size; index++){
+        checksum = (checksum ^ arr[index]) * 0x100000001B3ULL;
+    }
+    return checksum;
+}
+
+// true if the layout of the magic order in the header of the binary file adds up:
+// n_bits between 1 and the number of relevant blockers, offsets one after the other. Then n_bits and the size are returned
+static bool read_magic_layout(const uint64_t* header_n_bits, const uint64_t* header_offsets, const std::array<uint64_t, 64>& masks,
+                              int n_bits[64], int& n_magic_attacks){
+    int offsets[64];
+    for(int square = 0; square < 64; square++){
+        if(header_n_bits[square] < 1 || header_n_bits[square] > (uint64_t)pop_count(masks[square])){ return false; }
+        n_bits[square] = (int)header_n_bits[square];
+    }
+    n_magic_attacks = offsets_from_n_bits(n_bits, offsets);
+    for(int square = 0; square < 64; square++){
+        if(header_offsets[square] != (uint64_t)offsets[square]){ return false; }
+    }
+    return true;
+}
+
+std::string attack_tables_file_name(SlidersBackend order){
+    return (order == PEXT_BACKEND) ? "attack_tables_pext.bin" : "attack_tables_magic.bin";
+}
+
+bool map_attack_tables_file(std::string file_name, SlidersBackend order){
+    size_t size;
+    const uint64_t* data = map_binary_file(file_name, size);
+    if(data == nullptr){ return false; }
+    int n_bits_rook[64], n_bits_bishop[64], n_magic_rook = 0, n_magic_bishop = 0;
+    bool is_valid = (size >= attack_tables_header_size)
+        && data[0] == attack_tables_signature
+        && data[1] == attack_tables_version
+        && data[2] == (uint64_t)order
+        && read_magic_layout(data + 6, data + 6 + 64, rook_masks, n_bits_rook, n_magic_rook)
+        && read_magic_layout(data + 6 + 128, data + 6 + 192, bishop_masks, n_bits_bishop, n_magic_bishop);
+    // the sizes of the tables in the order of the file
+    if(is_valid){
+        is_valid = (data[3] == (uint64_t)((data[2] == PEXT_BACKEND) ? n_attacks_rook : n_magic_rook))
+            && (data[4] == (uint64_t)((data[2] == PEXT_BACKEND) ? n_attacks_bishop : n_magic_bishop))
+            && (size == attack_tables_header_size + 128 + data[3] + data[4]);
+    }
+    if(is_valid){ is_valid = (tables_checksum(0xCBF29CE484222325ULL, data + 6, size - 6) == data[5]); }
+    if(!is_valid){
+        unmap_binary_file(data, size);
+        return false;
+    }
+    if(mapped_tables_file != nullptr){ unmap_binary_file(mapped_tables_file, mapped_tables_file_size); }
+    mapped_tables_file = data;
+    mapped_tables_file_size = size;
+    const uint64_t* body = data + attack_tables_header_size;
+    // the layout is small: copy it, the magics and the attacks are used where they are
+    std::copy(n_bits_rook, n_bits_rook + 64, rook_n_bits);
+    std::copy(n_bits_bishop, n_bits_bishop + 64, bishop_n_bits);
+    get_magic_offsets();
+    rook_magics = body;
+    bishop_magics = body + 64;
+    rook_covered_squares_bitboards = body + 128;
+    bishop_covered_squares_bitboards = body + 128 + data[3];
+    tables_order = (SlidersBackend)data[2];
+    return true;
+}
+
+bool write_attack_tables_file(std::string file_name){
+    const int n_rook = tables_size(tables_order, true), n_bishop = tables_size(tables_order, false);
+    std::vector<uint64_t> data;
+    data.reserve(attack_tables_header_size + 128 + n_rook + n_bishop);
+    data.insert(data.end(), {attack_tables_signature, attack_tables_version, (uint64_t)tables_order, (uint64_t)n_rook, (uint64_t)n_bishop, 0ULL});
+    data.insert(data.end(), rook_n_bits, rook_n_bits + 64);
+    data.insert(data.end(), rook_offsets, rook_offsets + 64);
+    data.insert(data.end(), bishop_n_bits, bishop_n_bits + 64);
+    data.insert(data.end(), bishop_offsets, bishop_offsets + 64);
+    data.insert(data.end(), rook_magics, rook_magics + 64);
+    data.insert(data.end(), bishop_magics, bishop_magics + 64);
+    data.insert(data.end(), rook_covered_squares_bitboards, rook_covered_squares_bitboards + n_rook);
+    data.insert(data.end(), bishop_covered_squares_bitboards, bishop_covered_squares_bitboards + n_bishop);
+    data[5] = tables_checksum(0xCBF29CE484222325ULL, data.data() + 6, data.size() - 6);
+    // write a temporary file and then rename it: another engine starting now never maps a file that is half written.
+    // The temporary name is unique, so two writers at the same time don't write in the same file
+    std::random_device random_device;
+    uint64_t unique_id = ((uint64_t)random_device() << 32) | random_device();
+    std::ostringstream temporary_file_name;
+    temporary_file_name << file_name << "." << std::hex << unique_id << ".tmp";
+    if(!write_to_binary_file(data.data(), data.size(), temporary_file_name.str()) || !replace_file(temporary_file_name.str(), file_name)){
+        std::remove(temporary_file_name.str().c_str());
+        return false;
+    }
+    return true;
+}
+
+// n_bits as text, one number per square (like the magic numbers)
+static bool read_n_bits_file(int n_bits[64], std::string file_name){
+    std::ifstream fin(file_name);
+    if(!fin){ return false; }
+    for(int square = 0; square < 64; square++){
+        if(!(fin >> n_bits[square])){ return false; }
+    }
+    return true;
+}
+
+void read_magics_from_assets(std::string assets_directory){
+    read_from_file(rook_magics_storage, 64, assets_directory + "/rook_magics.txt");
+    read_from_file(bishop_magics_storage, 64, assets_directory + "/bishop_magics.txt");
+    rook_magics = rook_magics_storage;
+    bishop_magics = bishop_magics_storage;
+    // without the n_bits files (older assets) the magics have one bit per relevant blocker
+    get_fancy_magic_n_bits();
+    if(!read_n_bits_file(rook_n_bits, assets_directory + "/rook_n_bits.txt") || !read_n_bits_file(bishop_n_bits, assets_directory + "/bishop_n_bits.txt")){
+        get_fancy_magic_n_bits();
+    }
+    get_magic_offsets();
+}
+
+void write_magics_to_assets(std::string assets_directory){
+    uint64_t n_bits[64];
+    write_to_file(rook_magics, 64, assets_directory + "/rook_magics.txt");
+    write_to_file(bishop_magics, 64, assets_directory + "/bishop_magics.txt");
+    std::copy(rook_n_bits, rook_n_bits + 64, n_bits);
+    write_to_file(n_bits, 64, assets_directory + "/rook_n_bits.txt");
+    std::copy(bishop_n_bits, bishop_n_bits + 64, n_bits);
+    write_to_file(n_bits, 64, assets_directory + "/bishop_n_bits.txt");
+}
+
+void PreComputeBitboards(bool retrieve_from_file, std::string attack_tables_directory){
+    // the tables of non sliding pieces, the masks of relevant blockers and the between / line tables are constexpr (see Bitboards.h).
+    // One bit per relevant blocker, unless the magics come with their own n_bits (see DENSEST MAGICS)
+    get_fancy_magic_n_bits();
+    get_magic_offsets();
+    // choose the backend first, so that the tables are mapped in its order
+#ifdef BACCALA_TABLELESS_SLIDERS
+    // many threads per socket: keep the cache for the transposition table. The tables stay in the magic order, in case we switch back
+    const SlidersBackend backend = OBSTRUCTION_DIFFERENCE_BACKEND, order = MAGIC_BACKEND;
+#else
+    // PEXT is faster than the magics when the CPU supports it
+    const SlidersBackend backend = cpu_has_fast_pext() ? PEXT_BACKEND : MAGIC_BACKEND, order = backend;
+#endif
+#ifdef BACCALA_ATTACK_TABLES_DIR
+    if(attack_tables_directory.empty()){ attack_tables_directory = BACCALA_ATTACK_TABLES_DIR; }
+#endif
+    // first try to map the binary file of that order: the table pointers point in it, no copy at all
+    bool is_file_mapped = retrieve_from_file && !attack_tables_directory.empty()
+        && map_attack_tables_file(attack_tables_directory + "/" + attack_tables_file_name(order), order);
     // initialize covered squares for sliding pieces and save them
     if(!retrieve_from_file){
-        find_rook_magic(n_bits_rook, rook_covered_squares_bitboards, rook_magics);
-        find_bishop_magic(n_bits_bishop, bishop_covered_squares_bitboards, bishop_magics);
-        // save data
-        write_to_file(rook_magics, 64, "../assets/rook_magics.txt");
-        write_to_file(rook_covered_squares_bitboards, 64*n_rook_attacks, "../assets/rook_attacks.txt");
-        write_to_file(bishop_magics, 64, "../assets/bishop_magics.txt");
-        write_to_file(bishop_covered_squares_bitboards, 64*n_bishop_attacks, "../assets/bishop_attacks.txt");
-    }
-    // or load from a file
-    else{
-        read_from_file(rook_magics, 64, "../assets/rook_magics.txt");
-        read_from_file(rook_covered_squares_bitboards, 64*n_rook_attacks, "../assets/rook_attacks.txt");
-        read_from_file(bishop_magics, 64, "../assets/bishop_magics.txt");
-        read_from_file(bishop_covered_squares_bitboards, 64*n_bishop_attacks, "../assets/bishop_attacks.txt");
+        use_tables_storage(MAGIC_BACKEND);
+        find_rook_magic(rook_n_bits, rook_offsets, rook_tables_storage, rook_magics_storage);
+        find_bishop_magic(bishop_n_bits, bishop_offsets, bishop_tables_storage, bishop_magics_storage);
+        rook_magics = rook_magics_storage;
+        bishop_magics = bishop_magics_storage;
+        // save the magic numbers: the attacks are computed again from them (GenerateTables, fill_attack_tables)
+        write_magics_to_assets(BACCALA_ASSETS_DIR);
+        tables_order = MAGIC_BACKEND;
+    }
+#ifdef BACCALA_EMBEDDED_TABLES
+    // or point the tables at the ones compiled in the executable, in the same order (see tools/GenerateTables.cpp): no file to read
+    else if(!is_file_mapped){
+        std::copy(embedded_rook_n_bits, embedded_rook_n_bits + 64, rook_n_bits);
+        std::copy(embedded_bishop_n_bits, embedded_bishop_n_bits + 64, bishop_n_bits);
+        get_magic_offsets();
+        rook_magics = embedded_rook_magics;
+        bishop_magics = embedded_bishop_magics;
+        rook_covered_squares_bitboards = (order == PEXT_BACKEND) ? embedded_rook_pext_attacks : embedded_rook_attacks;
+        bishop_covered_squares_bitboards = (order == PEXT_BACKEND) ? embedded_bishop_pext_attacks : embedded_bishop_attacks;
+        tables_order = order;
     }
+#else
+    // or compute the attacks again from the magic numbers
+    else if(!is_file_mapped){
+        read_magics_from_assets(BACCALA_ASSETS_DIR);
+        fill_attack_tables();
+    }
+#endif
+    get_obstruction_difference_masks();
+    // nothing to do if the mapped file is already in the order of the backend, otherwise the tables are rewritten in it
+    set_sliders_backend(backend);
+    // covered squares with the vectorized Kogge-Stone when the CPU has AVX2, scalar otherwise
+    use_avx2 = cpu_has_avx2();
     // initialize masks for passed pawn and outpost detection
     get_passed_pawn_masks();
 }
 
 
 void CleanBitboards(){
-    delete [] rook_covered_squares_bitboards;
-    delete [] bishop_covered_squares_bitboards;
+    delete [] rook_tables_storage;
+    delete [] bishop_tables_storage;
+    rook_tables_storage = nullptr;
+    bishop_tables_storage = nullptr;
+    rook_tables_storage_size = 0;
+    bishop_tables_storage_size = 0;
+    unmap_binary_file(mapped_tables_file, mapped_tables_file_size);
+    mapped_tables_file = nullptr;
+    mapped_tables_file_size = 0;
+    rook_covered_squares_bitboards = nullptr;
+    bishop_covered_squares_bitboards = nullptr;
+    rook_magics = rook_magics_storage;
+    bishop_magics = bishop_magics_storage;
 }
 
-// generate the bitboard of covered squares by a given side (white or black)
-uint64_t GetCoveredSquares(uint64_t pieces[12], uint64_t& all_pieces, bool by_white){
+// generate the bitboard of covered squares by a given side (white or black), one attack lookup per piece
+template<Color C>
+uint64_t GetCoveredSquaresLookup(const uint64_t pieces[12], const uint64_t& all_pieces){
+    constexpr uint8_t friendly = ColorTraits<C>::friendly;
+    const uint64_t* pawn_covered_squares_bitboards = pawn_covered_squares_table<C>();
     uint64_t piece;
     uint64_t attacks = 0;
     unsigned long square;
-    uint64_t hash_index_rook, hash_index_bishop;
-
-    // white to move:
-    if(by_white){
-
-        // KING
-        piece = pieces[0];
-        // loop over all the pieces of the same type
-        while(piece){
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            attacks |= king_covered_squares_bitboards[square]; // retrieve attack bitboard
-            clear_last_active_bit(piece); // remove the evaluated piece
-        }
 
-        // QUEEN
-        piece = pieces[1];
-        while(piece){
-            _BitScanForward64(&square, piece); 
-            hash_index_rook = rook_hash_index(all_pieces, square, n_attacks_rook);
-            hash_index_bishop = bishop_hash_index(all_pieces, square, n_attacks_bishop);
-            attacks |= rook_covered_squares_bitboards[hash_index_rook]; 
-            attacks |= bishop_covered_squares_bitboards[hash_index_bishop];
-            clear_last_active_bit(piece);
-        }
+    // KING
+    piece = pieces[friendly];
+    // loop over all the pieces of the same type
+    while(piece){
+        square = get_last_active_bit(piece); // find position of piece and assign it to square
+        attacks |= king_covered_squares_bitboards[square]; // retrieve attack bitboard
+        clear_last_active_bit(piece); // remove the evaluated piece
+    }
 
-        // ROOK
-        piece = pieces[2];
-        while(piece){
-            _BitScanForward64(&square, piece); 
-            hash_index_rook = rook_hash_index(all_pieces, square, n_attacks_rook);
-            attacks |= rook_covered_squares_bitboards[hash_index_rook]; 
-            clear_last_active_bit(piece);
-        }
+    // QUEEN
+    piece = pieces[friendly + 1];
+    while(piece){
+        square = get_last_active_bit(piece); 
+        attacks |= rook_attacks(all_pieces, square);
+        attacks |= bishop_attacks(all_pieces, square);
+        clear_last_active_bit(piece);
+    }
 
-        // BISHOP
-        piece = pieces[3];
-        while(piece){
-            _BitScanForward64(&square, piece); 
-            hash_index_bishop = bishop_hash_index(all_pieces, square, n_attacks_bishop);
-            attacks |= bishop_covered_squares_bitboards[hash_index_bishop];
-            clear_last_active_bit(piece);
-        }
+    // ROOK
+    piece = pieces[friendly + 2];
+    while(piece){
+        square = get_last_active_bit(piece); 
+        attacks |= rook_attacks(all_pieces, square);
+        clear_last_active_bit(piece);
+    }
 
-        // KNIGHT
-        piece = pieces[4];
-        while(piece){
-            _BitScanForward64(&square, piece); 
-            attacks |= knight_covered_squares_bitboards[square]; 
-            clear_last_active_bit(piece);
-        }
+    // BISHOP
+    piece = pieces[friendly + 3];
+    while(piece){
+        square = get_last_active_bit(piece); 
+        attacks |= bishop_attacks(all_pieces, square);
+        clear_last_active_bit(piece);
+    }
 
-        // PAWNS
-        piece = pieces[5];
-        while(piece){
-            _BitScanForward64(&square, piece); 
-            attacks |= white_pawn_covered_squares_bitboards[square];
-            clear_last_active_bit(piece);
-        }
-        
-    }
-    // black to move:
-    else{
-
-        // KING
-        piece = pieces[6];
-        // loop over all the pieces of the same type
-        while(piece){
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            attacks |= king_covered_squares_bitboards[square]; // retrieve attack bitboard
-            clear_last_active_bit(piece); // remove the evaluated piece
-        }
+    // KNIGHT
+    piece = pieces[friendly + 4];
+    while(piece){
+        square = get_last_active_bit(piece); 
+        attacks |= knight_covered_squares_bitboards[square]; 
+        clear_last_active_bit(piece);
+    }
 
-        // QUEEN
-        piece = pieces[7];
-        while(piece){
-            _BitScanForward64(&square, piece); 
-            hash_index_rook = rook_hash_index(all_pieces, square, n_attacks_rook);
-            hash_index_bishop = bishop_hash_index(all_pieces, square, n_attacks_bishop);
-            attacks |= rook_covered_squares_bitboards[hash_index_rook]; 
-            attacks |= bishop_covered_squares_bitboards[hash_index_bishop];
-            clear_last_active_bit(piece);
-        }
+    // PAWNS
+    piece = pieces[friendly + 5];
+    while(piece){
+        square = get_last_active_bit(piece); 
+        attacks |= pawn_covered_squares_bitboards[square];
+        clear_last_active_bit(piece);
+    }
 
-        // ROOK
-        piece = pieces[8];
-        while(piece){
-            _BitScanForward64(&square, piece); 
-            hash_index_rook = rook_hash_index(all_pieces, square, n_attacks_rook);
-            attacks |= rook_covered_squares_bitboards[hash_index_rook]; 
-            clear_last_active_bit(piece);
-        }
+    return attacks;
+}
 
-        // BISHOP
-        piece = pieces[9];
-        while(piece){
-            _BitScanForward64(&square, piece); 
-            hash_index_bishop = bishop_hash_index(all_pieces, square, n_attacks_bishop);
-            attacks |= bishop_covered_squares_bitboards[hash_index_bishop];
-            clear_last_active_bit(piece);
-        }
+template uint64_t GetCoveredSquaresLookup<WHITE>(const uint64_t pieces[12], const uint64_t& all_pieces);
+template uint64_t GetCoveredSquaresLookup<BLACK>(const uint64_t pieces[12], const uint64_t& all_pieces);
 
-        // KNIGHT
-        piece = pieces[10];
-        while(piece){
-            _BitScanForward64(&square, piece); 
-            attacks |= knight_covered_squares_bitboards[square]; 
-            clear_last_active_bit(piece);
-        }
+// the setwise version is faster (see CoveredSquaresBenchmark)
+template<Color C>
+uint64_t GetCoveredSquares(const uint64_t pieces[12], const uint64_t& all_pieces){
+    return GetCoveredSquaresSetwise<C>(pieces, all_pieces, use_avx2);
+}
 
-        // PAWNS
-        piece = pieces[11];
-        while(piece){
-            _BitScanForward64(&square, piece); 
-            attacks |= black_pawn_covered_squares_bitboards[square];
-            clear_last_active_bit(piece);
-        }
+template uint64_t GetCoveredSquares<WHITE>(const uint64_t pieces[12], const uint64_t& all_pieces);
+template uint64_t GetCoveredSquares<BLACK>(const uint64_t pieces[12], const uint64_t& all_pieces);
 
+uint64_t GetCoveredSquares(const uint64_t pieces[12], const uint64_t& all_pieces, bool by_white){
+    return by_white ? GetCoveredSquares<WHITE>(pieces, all_pieces) : GetCoveredSquares<BLACK>(pieces, all_pieces);
+}
+
+// attacks of all the sliders in gen along one direction, towards higher squares (shift > 0) or lower squares (shift < 0).
+// The wrap mask removes the squares that a shift by one file left / right would bring to the other side of the board
+static inline uint64_t occluded_fill(uint64_t gen, uint64_t empty, int shift, uint64_t wrap_mask){
+    uint64_t pro = empty & wrap_mask;
+    if(shift > 0){
+        gen |= pro & (gen << shift);
+        pro &= pro << shift;
+        gen |= pro & (gen << 2*shift);
+        pro &= pro << 2*shift;
+        gen |= pro & (gen << 4*shift);
+        return (gen << shift) & wrap_mask;
     }
+    shift = -shift;
+    gen |= pro & (gen >> shift);
+    pro &= pro >> shift;
+    gen |= pro & (gen >> 2*shift);
+    pro &= pro >> 2*shift;
+    gen |= pro & (gen >> 4*shift);
+    return (gen >> shift) & wrap_mask;
+}
 
+uint64_t sliding_attacks_kogge_stone(uint64_t rooks, uint64_t bishops, uint64_t empty){
+    const uint64_t not_file_a = ~files_bitboards[0];
+    const uint64_t not_file_h = ~files_bitboards[7];
+    return occluded_fill(rooks, empty, 1, not_file_a) | occluded_fill(rooks, empty, -1, not_file_h) |
+           occluded_fill(rooks, empty, 8, ~0ULL) | occluded_fill(rooks, empty, -8, ~0ULL) |
+           occluded_fill(bishops, empty, 9, not_file_a) | occluded_fill(bishops, empty, -9, not_file_h) |
+           occluded_fill(bishops, empty, 7, not_file_h) | occluded_fill(bishops, empty, -7, not_file_a);
+}
+
+#ifndef BACCALA_X86_64
+uint64_t sliding_attacks_kogge_stone_avx2(uint64_t rooks, uint64_t bishops, uint64_t empty){
+    return sliding_attacks_kogge_stone(rooks, bishops, empty);
+}
+#else
+BACCALA_TARGET("avx2") uint64_t sliding_attacks_kogge_stone_avx2(uint64_t rooks, uint64_t bishops, uint64_t empty){
+    const long long not_file_a = (long long)~files_bitboards[0];
+    const long long not_file_h = (long long)~files_bitboards[7];
+    // 4 lanes: +1 (rooks), +8 (rooks), +7 (bishops), +9 (bishops) with left shifts; -1, -8, -7, -9 with right shifts
+    const __m256i shift = _mm256_setr_epi64x(1, 8, 7, 9);
+    const __m256i shift2 = _mm256_setr_epi64x(2, 16, 14, 18);
+    const __m256i shift4 = _mm256_setr_epi64x(4, 32, 28, 36);
+    const __m256i left_wrap = _mm256_setr_epi64x(not_file_a, -1LL, not_file_h, not_file_a);
+    const __m256i right_wrap = _mm256_setr_epi64x(not_file_h, -1LL, not_file_a, not_file_h);
+    const __m256i all_empty = _mm256_set1_epi64x((long long)empty);
+    __m256i gen_left = _mm256_setr_epi64x((long long)rooks, (long long)rooks, (long long)bishops, (long long)bishops);
+    __m256i gen_right = gen_left;
+    __m256i pro_left = _mm256_and_si256(all_empty, left_wrap);
+    __m256i pro_right = _mm256_and_si256(all_empty, right_wrap);
+    // same steps as occluded_fill, for the 8 directions at once
+    gen_left = _mm256_or_si256(gen_left, _mm256_and_si256(pro_left, _mm256_sllv_epi64(gen_left, shift)));
+    gen_right = _mm256_or_si256(gen_right, _mm256_and_si256(pro_right, _mm256_srlv_epi64(gen_right, shift)));
+    pro_left = _mm256_and_si256(pro_left, _mm256_sllv_epi64(pro_left, shift));
+    pro_right = _mm256_and_si256(pro_right, _mm256_srlv_epi64(pro_right, shift));
+    gen_left = _mm256_or_si256(gen_left, _mm256_and_si256(pro_left, _mm256_sllv_epi64(gen_left, shift2)));
+    gen_right = _mm256_or_si256(gen_right, _mm256_and_si256(pro_right, _mm256_srlv_epi64(gen_right, shift2)));
+    pro_left = _mm256_and_si256(pro_left, _mm256_sllv_epi64(pro_left, shift2));
+    pro_right = _mm256_and_si256(pro_right, _mm256_srlv_epi64(pro_right, shift2));
+    gen_left = _mm256_or_si256(gen_left, _mm256_and_si256(pro_left, _mm256_sllv_epi64(gen_left, shift4)));
+    gen_right = _mm256_or_si256(gen_right, _mm256_and_si256(pro_right, _mm256_srlv_epi64(gen_right, shift4)));
+    __m256i attacks = _mm256_or_si256(_mm256_and_si256(_mm256_sllv_epi64(gen_left, shift), left_wrap),
+                                      _mm256_and_si256(_mm256_srlv_epi64(gen_right, shift), right_wrap));
+    // OR of the 4 lanes
+    __m128i half = _mm_or_si128(_mm256_castsi256_si128(attacks), _mm256_extracti128_si256(attacks, 1));
+    return (uint64_t)_mm_cvtsi128_si64(half) | (uint64_t)_mm_extract_epi64(half, 1);
+}
+#endif
+
+// XCR0 register: which registers the OS saves when it switches threads
+static uint64_t xgetbv0(){
+#ifndef BACCALA_X86_64
+    return 0ULL;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+bool cpu_has_avx2(){
+    int info[4];
+    cpuid(info, 0, 0);
+    if(info[0] < 7){ return false; }
+    // leaf 1: ECX bit 27 = OSXSAVE (XGETBV is available), ECX bit 28 = AVX
+    cpuid(info, 1, 0);
+    if((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0){ return false; }
+    // XCR0 bits 1 and 2: the OS saves the XMM and YMM registers, otherwise the AVX registers are corrupted by a thread switch
+    if((xgetbv0() & 0b110) != 0b110){ return false; }
+    // leaf 7: EBX bit 5 = AVX2
+    cpuid(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+template<Color C>
+uint64_t GetCoveredSquaresSetwise(const uint64_t pieces[12], const uint64_t& all_pieces, bool use_avx2){
+    constexpr uint8_t friendly = ColorTraits<C>::friendly;
+    constexpr int pawn_push = ColorTraits<C>::pawn_push;
+    uint64_t piece;
+    uint64_t attacks = 0;
+    unsigned long square;
+
+    // QUEEN, ROOK, BISHOP: all at once
+    uint64_t rooks = pieces[friendly + 1] | pieces[friendly + 2];
+    uint64_t bishops = pieces[friendly + 1] | pieces[friendly + 3];
+    attacks |= use_avx2 ? sliding_attacks_kogge_stone_avx2(rooks, bishops, ~all_pieces) : sliding_attacks_kogge_stone(rooks, bishops, ~all_pieces);
+
+    // PAWNS: all at once (see shift_bitboard)
+    attacks |= shift_bitboard<pawn_push - 1>(pieces[friendly + 5]) | shift_bitboard<pawn_push + 1>(pieces[friendly + 5]);
+
+    // KING
+    square = get_last_active_bit(pieces[friendly]);
+    if(pieces[friendly]){ attacks |= king_covered_squares_bitboards[square]; }
+
+    // KNIGHT
+    piece = pieces[friendly + 4];
+    while(piece){
+        square = get_last_active_bit(piece); 
+        attacks |= knight_covered_squares_bitboards[square]; 
+        clear_last_active_bit(piece);
+    }
     return attacks;
 }
 
+template uint64_t GetCoveredSquaresSetwise<WHITE>(const uint64_t pieces[12], const uint64_t& all_pieces, bool use_avx2);
+template uint64_t GetCoveredSquaresSetwise<BLACK>(const uint64_t pieces[12], const uint64_t& all_pieces, bool use_avx2);
+
 void get_passed_pawn_masks(){
     int i, j;
     uint64_t rank_bb, file_bb;
@@ -593,6 +994,30 @@ void get_passed_pawn_masks(){
     }
 }
 
+void get_obstruction_difference_masks(){
+    int i, j, i2, j2;
+    uint64_t rook_rays, bishop_rays, lines[4];
+    for(int square = 0; square < 64; square++){
+        i = square / 8; j = square % 8;
+        // the rays of the rook and of the bishop on an empty board, split in the 4 lines
+        rook_rays = rook_covered_squares_from_blockers(0ULL, i, j);
+        bishop_rays = bishop_covered_squares_from_blockers(0ULL, i, j);
+        lines[0] = rook_rays & files_bitboards[j];
+        lines[1] = rook_rays & ranks_bitboards[i];
+        lines[2] = 0ULL; lines[3] = 0ULL;
+        for(int square2 = 0; square2 < 64; square2++){
+            i2 = square2 / 8; j2 = square2 % 8;
+            if(i2 - i == j2 - j){ lines[2] |= bishop_rays & (1ULL << square2); }
+            else if(i2 - i == j - j2){ lines[3] |= bishop_rays & (1ULL << square2); }
+        }
+        // squares with lower / higher index than the square
+        for(int line = 0; line < 4; line++){
+            line_lower_masks[square][line] = lines[line] & ((1ULL << square) - 1);
+            line_upper_masks[square][line] = lines[line] & ~((1ULL << square) - 1);
+        }
+    }
+}
+
 size_t count_doubled_pawns(uint64_t pawn_bitboard){
     uint64_t bb = pawn_bitboard & (pawn_bitboard >> 8);
     return pop_count(bb);
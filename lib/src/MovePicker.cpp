@@ -0,0 +1,178 @@
+#include <MovePicker.h>
+#include <Bitboards.h>
+#include <Utilities.h>
+#include <algorithm>
+#include <cstdlib>
+
+MoveNew killer_moves[MAX_PLY][2];
+
+void ClearKillerMoves(){
+    for(int ply = 0; ply < MAX_PLY; ply++){
+        killer_moves[ply][0] = 0;
+        killer_moves[ply][1] = 0;
+    }
+}
+
+void StoreKillerMove(const MoveNew& move, int ply){
+    // only quiet moves: quiet, double push, castling (flags 0, 1, 2, 3)
+    if((move >> 12) > 3 || ply >= MAX_PLY){ return; }
+    // don't store the same killer twice, otherwise we lose the other one
+    if(killer_moves[ply][0] == move){ return; }
+    killer_moves[ply][1] = killer_moves[ply][0];
+    killer_moves[ply][0] = move;
+}
+
+// true if the square is attacked by the opponent (enemy = 0 if white, 6 if black) for the given occupancy of the board.
+// The pieces in 'removed' are ignored: they are captured by the move that we are checking
+static bool IsSquareAttacked(const Position& pos, unsigned long square, uint64_t occupancy, uint8_t enemy, uint64_t removed){
+    // a black pawn attacks the square if a white pawn on the square would attack the black pawn, and vice versa
+    const uint64_t* pawn_covered_squares_bitboards = (enemy == 6) ? white_pawn_covered_squares_bitboards.data() : black_pawn_covered_squares_bitboards.data();
+    if(knight_covered_squares_bitboards[square] & pos.pieces[enemy + 4] & ~removed){ return true; }
+    if(pawn_covered_squares_bitboards[square] & pos.pieces[enemy + 5] & ~removed){ return true; }
+    if(king_covered_squares_bitboards[square] & pos.pieces[enemy]){ return true; }
+    uint64_t attacks_rook = rook_attacks(occupancy, square);
+    if(attacks_rook & (pos.pieces[enemy + 1] | pos.pieces[enemy + 2]) & ~removed){ return true; }
+    uint64_t attacks_bishop = bishop_attacks(occupancy, square);
+    if(attacks_bishop & (pos.pieces[enemy + 1] | pos.pieces[enemy + 3]) & ~removed){ return true; }
+    return false;
+}
+
+// Check if a move coming from outside the move generator (hash move, killer) is legal in the position.
+// The move could have been found in another position (killer, or hash collision), so nothing can be assumed:
+// first we check that it is a possible move of the piece on the starting square (IsPseudoLegal), then that it doesn't leave our king in check.
+// The picker returns only legal moves, so the king safety is checked here, without making the move (as IsLegal would)
+static bool IsValidMove(const Position& pos, const MoveNew& move){
+    uint8_t from, to, flags, piece;
+    unsigned long king_square;
+    uint64_t occupancy, removed;
+    if(!IsPseudoLegal(pos, move)){ return false; }
+    from = move & 0b00111111;
+    to = (move >> 6) & 0b00111111;
+    flags = (move >> 12);
+    const uint8_t friendly = pos.white_to_move ? 0 : 6;
+    const uint8_t enemy = pos.white_to_move ? 6 : 0;
+    piece = pos.piece_on[from];
+
+    // the king cannot castle out of check, nor through or into a covered square
+    if(flags == 2 || flags == 3){
+        const uint64_t enemy_covered_squares = pos.white_to_move ? CoveredSquares<BLACK>(pos) : CoveredSquares<WHITE>(pos);
+        return (enemy_covered_squares & (squares_between[from][to] | (1ULL << from) | (1ULL << to))) == 0;
+    }
+    removed = 1ULL << to;
+    // the pawn captured en-passant is behind the target square
+    if(flags == 5){ removed |= 1ULL << (pos.white_to_move ? to + 8 : to - 8); }
+
+    // LEGALITY: after the move, our king must not be attacked
+    occupancy = (pos.all_pieces & ~(1ULL << from) & ~removed) | (1ULL << to);
+    if(piece == friendly){ king_square = to; }
+    else{ king_square = get_last_active_bit(pos.pieces[friendly]); }
+    return !IsSquareAttacked(pos, king_square, occupancy, enemy, removed);
+}
+
+MovePicker::MovePicker(const Position& pos, MoveNew hash_move, int ply) : pos(pos), hash_move(hash_move){
+    if(ply < MAX_PLY){
+        killers[0] = killer_moves[ply][0];
+        killers[1] = killer_moves[ply][1];
+    }
+    else{
+        killers[0] = 0;
+        killers[1] = 0;
+    }
+}
+
+MoveNew MovePicker::NextMove(){
+    MoveNew move;
+    uint8_t from, to, flags, attacker, victim;
+    switch(stage){
+        case HASH_MOVE:
+            stage = GENERATE_CAPTURES;
+            if(hash_move != 0 && IsValidMove(pos, hash_move)){ return hash_move; }
+            hash_move = 0;
+            [[fallthrough]];
+
+        case GENERATE_CAPTURES:
+            n_moves = LegalMovesNew(pos, moves, CAPTURES);
+            current = 0;
+            // score the captures with MVV - LVA (as in ScoreMove) and the promotions with the value of the new piece
+            for(int move_index = 0; move_index < n_moves; move_index++){
+                from = moves[move_index] & 0b00111111;
+                to = (moves[move_index] >> 6) & 0b00111111;
+                flags = (moves[move_index] >> 12);
+                attacker = pos.piece_on[from];
+                // in case of en-passant the target square is empty: the victim is a pawn
+                victim = (flags == 5) ? (pos.white_to_move ? 11 : 5) : pos.piece_on[to];
+                scores[move_index] = 0;
+                if(victim != NO_PIECE){
+                    scores[move_index] += BONUS_FOR_CAPTURE + abs(PIECES_VALUES[victim]) - abs(PIECES_VALUES[attacker]);
+                }
+                // promoted piece: 11 = Q, 10 = R, 9 = B, 8 = N (+4 if capture) --> index 1, 2, 3, 4 in PIECES_VALUES
+                if(flags >= 8){
+                    scores[move_index] += BONUS_FOR_PROMOTION + PIECES_VALUES[4 - (flags & 0b0011)];
+                }
+            }
+            stage = PICK_CAPTURES;
+            [[fallthrough]];
+
+        case PICK_CAPTURES:
+            while(current < n_moves){
+                // bring the best of the remaining captures to the current index
+                int best_index = current;
+                for(int move_index = current + 1; move_index < n_moves; move_index++){
+                    if(scores[move_index] > scores[best_index]){ best_index = move_index; }
+                }
+                std::swap(moves[current], moves[best_index]);
+                std::swap(scores[current], scores[best_index]);
+                move = moves[current];
+                current++;
+                if(move == hash_move){ continue; }
+                // a score below the capture bonus means that the victim is less valuable than the attacker (promotions excluded):
+                // only then the capture can lose material
+                if((move >> 12) == 4 && scores[current - 1] < BONUS_FOR_CAPTURE && StaticExchangeEvaluation(pos, move) < 0){
+                    bad_captures[n_bad_captures++] = move;
+                    continue;
+                }
+                return move;
+            }
+            stage = KILLER_MOVES;
+            current_killer = 0;
+            [[fallthrough]];
+
+        case KILLER_MOVES:
+            while(current_killer < 2){
+                move = killers[current_killer];
+                current_killer++;
+                // killers are quiet moves: the captures have already been returned
+                bool is_repeated = (current_killer == 2 && move == killers[0]);
+                if(move != 0 && (move >> 12) <= 3 && move != hash_move && !is_repeated && IsValidMove(pos, move)){ return move; }
+                // don't skip it later among the quiet moves if it was not returned here
+                killers[current_killer - 1] = 0;
+            }
+            stage = GENERATE_QUIETS;
+            [[fallthrough]];
+
+        case GENERATE_QUIETS:
+            n_moves = LegalMovesNew(pos, moves, QUIETS);
+            current = 0;
+            stage = PICK_QUIETS;
+            [[fallthrough]];
+
+        case PICK_QUIETS:
+            while(current < n_moves){
+                move = moves[current];
+                current++;
+                if(move != hash_move && move != killers[0] && move != killers[1]){ return move; }
+            }
+            stage = BAD_CAPTURES;
+            [[fallthrough]];
+
+        case BAD_CAPTURES:
+            // already sorted by MVV - LVA
+            if(current_bad_capture < n_bad_captures){ return bad_captures[current_bad_capture++]; }
+            stage = NO_MORE_MOVES;
+            [[fallthrough]];
+
+        case NO_MORE_MOVES:
+            return 0;
+    }
+    return 0;
+}
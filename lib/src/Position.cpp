@@ -1,11 +1,13 @@
 #include <Position.h>
 #include <Utilities.h>
 #include <Bitboards.h>
+#include <TranspositionTable.h>
 #include <iostream>
+#include <cassert>
 #include <sstream>
 #include <cstdint>
-#include <intrin.h>
 #include <vector>
+#include <algorithm>
 
 Position PositionFromFen(std::string fen)
 {
@@ -24,6 +26,8 @@ Position PositionFromFen(std::string fen)
     int j = 0; 
     int square = 0;
     int c_casted; 
+    char pieces_list[12] = {'K', 'Q', 'R', 'B', 'N', 'P', 'k', 'q', 'r', 'b', 'n', 'p'};
+    for(square = 0; square < 64; square++){ pos.piece_on[square] = NO_PIECE; } // initialize mailbox board
     // loop over characters of the FEN string
     for(char& c: words[0]){
         c_casted = c - '0';
@@ -36,73 +40,65 @@ Position PositionFromFen(std::string fen)
             //pos.white_material_value += WHITE_KING_VALUE;
             bit_set(pos.pieces[0], i, j);
             bit_set(pos.white_pieces, i, j);
-            pos.white_covered_squares |= king_covered_squares_bitboards[square];
         }
         else if(c == 'Q'){ 
             //pos.white_material_value += WHITE_QUEEN_VALUE;
             bit_set(pos.pieces[1], i, j);
             bit_set(pos.white_pieces, i, j);
-            // calculation of covered squares is delayed for sliding pieces --> see below
         }
         else if(c == 'R'){ 
             //pos.white_material_value += WHITE_ROOK_VALUE;
             bit_set(pos.pieces[2], i, j);
             bit_set(pos.white_pieces, i, j);
-            // calculation of covered squares is delayed for sliding pieces --> see below
         }
         else if(c == 'B'){ 
             //pos.white_material_value += WHITE_BISHOP_VALUE;
             bit_set(pos.pieces[3], i, j);
             bit_set(pos.white_pieces, i, j);
-            // calculation of covered squares is delayed for sliding pieces --> see below
         }
         else if(c == 'N'){ 
             //pos.white_material_value += WHITE_KNIGHT_VALUE;
             bit_set(pos.pieces[4], i, j);
             bit_set(pos.white_pieces, i, j);
-            pos.white_covered_squares |= knight_covered_squares_bitboards[square];
         }
         else if(c == 'P'){ 
             //pos.white_material_value += WHITE_PAWN_VALUE;
             bit_set(pos.pieces[5], i, j);
             bit_set(pos.white_pieces, i, j);
-            pos.white_covered_squares |= white_pawn_covered_squares_bitboards[square];
         }
         else if(c == 'k'){ 
             //pos.black_material_value += BLACK_KING_VALUE;
             bit_set(pos.pieces[6], i, j);
             bit_set(pos.black_pieces, i, j);
-            pos.black_covered_squares |= king_covered_squares_bitboards[square];
         }
         else if(c == 'q'){ 
             //pos.black_material_value += BLACK_QUEEN_VALUE;
             bit_set(pos.pieces[7], i, j);
             bit_set(pos.black_pieces, i, j);
-            // calculation of covered squares is delayed for sliding pieces --> see below
         }
         else if(c == 'r'){ 
             //pos.black_material_value += BLACK_ROOK_VALUE;
             bit_set(pos.pieces[8], i, j);
             bit_set(pos.black_pieces, i, j);
-            // calculation of covered squares is delayed for sliding pieces --> see below
         }
         else if(c == 'b'){ 
             //pos.black_material_value += BLACK_BISHOP_VALUE;
             bit_set(pos.pieces[9], i, j);
             bit_set(pos.black_pieces, i, j);
-            // calculation of covered squares is delayed for sliding pieces --> see below
         }
         else if(c == 'n'){ 
             //pos.black_material_value += BLACK_KNIGHT_VALUE;
             bit_set(pos.pieces[10], i, j);
             bit_set(pos.black_pieces, i, j);
-            pos.black_covered_squares |= knight_covered_squares_bitboards[square];
         }
         else if(c == 'p'){ 
             //pos.black_material_value += BLACK_PAWN_VALUE;
             bit_set(pos.pieces[11], i, j);
             bit_set(pos.black_pieces, i, j);
-            pos.black_covered_squares |= black_pawn_covered_squares_bitboards[square];
+        }
+        // fill the mailbox board
+        for(uint8_t piece_index = 0; piece_index < 12; piece_index++){
+            if(c == pieces_list[piece_index]){ pos.piece_on[square] = piece_index; }
         }
         j++; 
     }
@@ -129,64 +125,10 @@ Position PositionFromFen(std::string fen)
     pos.half_move_counter = std::stoi(words[4]);
 //    pos.move_counter = std::stoi(words[5]);
 
-    // complete pieces bitboards for sliding pieces
-    uint64_t hash_index, piece;
-    unsigned long sq;
-    int n_attacks_rook = IntPow(2, n_bits_rook);
-    int n_attacks_bishop = IntPow(2, n_bits_bishop);
     pos.all_pieces = pos.white_pieces | pos.black_pieces;
-    // white rook covered squares
-    piece = pos.pieces[2]; 
-    while(piece){ // loop through all the occurences of the rook
-        _BitScanForward64(&sq, piece); // find square
-        hash_index = rook_hash_index(pos.all_pieces, sq, n_attacks_rook); // find hash index for that square
-        pos.white_covered_squares |= rook_covered_squares_bitboards[hash_index]; // generate covered squares
-        clear_last_active_bit(piece); // remove the piece and consider the next one
-    }
-    // black rook covered squares
-    piece = pos.pieces[8]; 
-    while(piece){ // loop through all the occurences of the rook
-        _BitScanForward64(&sq, piece); // find square
-        hash_index = rook_hash_index(pos.all_pieces, sq, n_attacks_rook); // find hash index for that square
-        pos.black_covered_squares |= rook_covered_squares_bitboards[hash_index]; // generate covered squares
-        clear_last_active_bit(piece); // remove the piece and consider the next one
-    }
-    // white bishop 
-    piece = pos.pieces[3];
-    while(piece){ // loop through all the occurences of the rook
-        _BitScanForward64(&sq, piece); // find square
-        hash_index = bishop_hash_index(pos.all_pieces, sq, n_attacks_bishop); // find hash index for that square
-        pos.white_covered_squares |= bishop_covered_squares_bitboards[hash_index]; // generate covered squares
-        clear_last_active_bit(piece); // remove the piece and consider the next one
-    }
-    // black bishop 
-    piece = pos.pieces[9];
-    while(piece){ // loop through all the occurences of the rook
-        _BitScanForward64(&sq, piece); // find square
-        hash_index = bishop_hash_index(pos.all_pieces, sq, n_attacks_bishop); // find hash index for that square
-        pos.black_covered_squares |= bishop_covered_squares_bitboards[hash_index]; // generate covered squares
-        clear_last_active_bit(piece); // remove the piece and consider the next one
-    }
-    // white queen 
-    piece = pos.pieces[1];
-    while(piece){ // loop through all the occurences of the rook
-        _BitScanForward64(&sq, piece); // find square
-        hash_index = bishop_hash_index(pos.all_pieces, sq, n_attacks_bishop); // find hash index for that square
-        pos.white_covered_squares |= bishop_covered_squares_bitboards[hash_index]; // generate covered squares
-        hash_index = rook_hash_index(pos.all_pieces, sq, n_attacks_rook); // find hash index for that square
-        pos.white_covered_squares |= rook_covered_squares_bitboards[hash_index]; // generate covered squares
-        clear_last_active_bit(piece); // remove the piece and consider the next one
-    }
-    // black queen 
-    piece = pos.pieces[7];
-    while(piece){ // loop through all the occurences of the rook
-        _BitScanForward64(&sq, piece); // find square
-        hash_index = bishop_hash_index(pos.all_pieces, sq, n_attacks_bishop); // find hash index for that square
-        pos.black_covered_squares |= bishop_covered_squares_bitboards[hash_index]; // generate covered squares
-        hash_index = rook_hash_index(pos.all_pieces, sq, n_attacks_rook); // find hash index for that square
-        pos.black_covered_squares |= rook_covered_squares_bitboards[hash_index]; // generate covered squares
-        clear_last_active_bit(piece); // remove the piece and consider the next one
-    }
+
+    // compute the Zobrist key from scratch (the Zobrist table must be initialized already)
+    pos.hash = ZobristHashing(pos);
     
     return pos;
 }
@@ -204,7 +146,7 @@ void PrintBoard(Position pos){
         if(piece != 0ULL){
             // loop over all pieces of the same type (e.g. find all the rooks, all the pawns etc...)
             while(piece){
-                _BitScanForward64(&square, piece); // this changes square to the square where the piece is positioned
+                square = get_last_active_bit(piece); // this changes square to the square where the piece is positioned
                 clear_last_active_bit(piece);     
                 board[square] = pieces_list[index]; // store it on the right square of the board with the right letter
             }
@@ -230,7 +172,7 @@ int PositionScore(Position& pos){
     // white king
     piece = pos.pieces[0];
     if(piece){
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         if(pos.black_material_value < -2000){ // very rough logic to distinguish middlegame fron endgame
             score += kingPST_Middlegame[square];
         }
@@ -241,28 +183,28 @@ int PositionScore(Position& pos){
     // white queen
     piece = pos.pieces[1];
     while(piece){ // loop until all the white queens are considered
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         score += queenPST[square];
         clear_last_active_bit(piece);   
     }
     // white rook
     piece = pos.pieces[2];
     while(piece){ // loop until all the white queens are considered
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         score += rookPST[square];
         clear_last_active_bit(piece);   
     }
     // white bishop
     piece = pos.pieces[3];
     while(piece){ // loop until all the white queens are considered
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         score += bishopPST[square];
         clear_last_active_bit(piece);   
     }
     // white knight
     piece = pos.pieces[4];
     while(piece){ // loop until all the white queens are considered
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         score += knightPST[square];
         clear_last_active_bit(piece);   
         // bonus for outpost squares ...
@@ -270,7 +212,7 @@ int PositionScore(Position& pos){
     // white pawns
     piece = pos.pieces[5];
     while(piece){ // loop until all the white queens are considered
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         score += white_pawnPST[square];
         clear_last_active_bit(piece);   
         // bonus for passed pawns ...
@@ -282,7 +224,7 @@ int PositionScore(Position& pos){
     // black king
     piece = pos.pieces[6];
     if(piece){
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         if(pos.white_material_value > 2000){ // very rough logic to distinguish middlegame fron endgame
             score -= kingPST_Middlegame[56 - square + 2*(square%8)];
         }
@@ -293,28 +235,28 @@ int PositionScore(Position& pos){
     // black queen
     piece = pos.pieces[7];
     while(piece){ // loop until all the white queens are considered
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         score -= queenPST[56 - square + 2*(square%8)];
         clear_last_active_bit(piece);   
     }
     // black rook
     piece = pos.pieces[8];
     while(piece){ // loop until all the white queens are considered
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         score -= rookPST[56 - square + 2*(square%8)];
         clear_last_active_bit(piece);   
     }
     // black bishop
     piece = pos.pieces[9];
     while(piece){ // loop until all the white queens are considered
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         score -= bishopPST[56 - square + 2*(square%8)];
         clear_last_active_bit(piece);   
     }
     // black knight
     piece = pos.pieces[10];
     while(piece){ // loop until all the white queens are considered
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         score -= knightPST[56 - square + 2*(square%8)];
         clear_last_active_bit(piece);   
         // bonus for outpost ...
@@ -322,7 +264,7 @@ int PositionScore(Position& pos){
     // black pawns
     piece = pos.pieces[11];
     while(piece){ // loop until all the white queens are considered
-        _BitScanForward64(&square, piece);
+        square = get_last_active_bit(piece);
         score -= black_pawnPST[square];
         clear_last_active_bit(piece);
         // bonus for passed pawns: the black pawn looks forward and if no white pawns are found, it is a passer
@@ -340,2066 +282,1129 @@ int PositionScore(Position& pos){
     return 0;
 }
 
-void PseudoLegalMoves(const Position& pos, MoveNew* moves){
-    uint8_t move_index = 0;
-    uint64_t piece, hash_index_rook, hash_index_bishop; 
-    unsigned long square, target_square;
-    uint64_t attacks;
-    bool is_capture;
-    uint16_t flags;
+// write the move of a pawn to the target square: 4 moves if it promotes, or a normal move / capture
+static void AddPawnMove(MoveNew* moves, uint8_t& move_index, unsigned long square, unsigned long target_square, uint16_t flags, unsigned long promotion_rank){
+    if(target_square / 8 == promotion_rank){
+        // 11 = Q, 10 = R, 9 = B, 8 = N (+4 if capture)
+        for(uint16_t promotion_flags = 11; promotion_flags >= 8; promotion_flags--){
+            moves[move_index] = EncodeMoveNew(square, target_square, promotion_flags + flags);
+            move_index++;
+        }
+    }
+    else{
+        moves[move_index] = EncodeMoveNew(square, target_square, flags);
+        move_index++;
+    }
+}
 
-    // WHITE MOVES
-    if(pos.white_to_move){
+// write the moves of all the pawns that moved by the same Delta (from = to - Delta) to the squares in targets
+template<int Delta>
+static void AddPawnMoves(MoveNew* moves, uint8_t& move_index, uint64_t targets, uint16_t flags, unsigned long promotion_rank){
+    unsigned long target_square;
+    while(targets){
+        target_square = get_last_active_bit(targets);
+        AddPawnMove(moves, move_index, target_square - Delta, target_square, flags, promotion_rank);
+        clear_last_active_bit(targets);
+    }
+}
 
-        // King
-        piece = pos.pieces[0];
-        while(piece){
-            // find position of piece and assign it to square
-            _BitScanForward64(&square, piece); 
-            attacks = king_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.white_pieces; // exclude self-capture
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.black_pieces, target_square);
-                is_capture ? flags = 4 : flags = 0;
-                // save the move
-                moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                move_index++;
-                // remove considered attack
-                clear_last_active_bit(attacks); 
-            }
-            // remove considered piece
-            clear_last_active_bit(piece);
-        }
+// Pushes, double pushes and captures of a set of pawns, computed for all the pawns at once by shifting their bitboard.
+// Only the pushes landing in push_mask and the captures landing in capture_mask are written; en-passant is done by the callers.
+// e.g. white pawns, single push = shift by -8 on the empty squares;
+// double push = shift again the single pushes that reached the 3rd rank, again on the empty squares
+// (so a pawn blocked on the 3rd rank cannot jump over the blocker)
+template<Color Us>
+static void AddPawnMovesSetwise(const Position& pos, MoveNew* moves, uint8_t& move_index, uint64_t pawns, uint64_t push_mask, uint64_t capture_mask){
+    constexpr int pawn_push = ColorTraits<Us>::pawn_push;
+    // captures towards the a-file and towards the h-file
+    constexpr int capture_left = pawn_push - 1;
+    constexpr int capture_right = pawn_push + 1;
+    constexpr int promotion_rank = ColorTraits<Us>::promotion_rank;
+    const uint64_t enemy_pieces = PiecesOf<~Us>(pos);
 
-        // Queen
-        piece = pos.pieces[1]; // retrieve bitboard of queens
-        while(piece){ // consider all the queens
-            _BitScanForward64(&square, piece); // find position of queen and assign it to square
-            // retrieve bitboard of queen moves
-            hash_index_rook = rook_hash_index(pos.all_pieces, square, n_attacks_rook);
-            hash_index_bishop = bishop_hash_index(pos.all_pieces, square, n_attacks_bishop);
-            attacks = rook_covered_squares_bitboards[hash_index_rook] | bishop_covered_squares_bitboards[hash_index_bishop];
-            attacks &= ~pos.white_pieces; // excluse self-capture
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.black_pieces, target_square);
-                is_capture ? flags = 4 : flags = 0;
-                moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                move_index++;
-                clear_last_active_bit(attacks); 
-            }
-            clear_last_active_bit(piece);
-        }
+    uint64_t single_pushes = shift_bitboard<pawn_push>(pawns) & ~pos.all_pieces;
+    uint64_t double_pushes = shift_bitboard<pawn_push>(single_pushes) & ~pos.all_pieces & ranks_bitboards[ColorTraits<Us>::double_push_rank];
+    uint64_t captures_left = shift_bitboard<capture_left>(pawns) & enemy_pieces & capture_mask;
+    uint64_t captures_right = shift_bitboard<capture_right>(pawns) & enemy_pieces & capture_mask;
 
-        // Rook
-        piece = pos.pieces[2];
-        while(piece){
-            _BitScanForward64(&square, piece); // find position of queen and assign it to square
-            // retrieve bitboard of queen moves
-            hash_index_rook = rook_hash_index(pos.all_pieces, square, n_attacks_rook);
-            attacks = rook_covered_squares_bitboards[hash_index_rook];
-            attacks &= ~pos.white_pieces; // excluse self-capture
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.black_pieces, target_square);
-                is_capture ? flags = 4 : flags = 0;
-                moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                move_index++;
-                clear_last_active_bit(attacks); 
-            }
-            clear_last_active_bit(piece);
-        }
+    AddPawnMoves<capture_left>(moves, move_index, captures_left, 4, promotion_rank);
+    AddPawnMoves<capture_right>(moves, move_index, captures_right, 4, promotion_rank);
+    AddPawnMoves<pawn_push>(moves, move_index, single_pushes & push_mask, 0, promotion_rank);
+    AddPawnMoves<2*pawn_push>(moves, move_index, double_pushes & push_mask, 1, promotion_rank);
+}
 
-        // Bishop
-        piece = pos.pieces[3]; // retrieve bitboard of queens
-        while(piece){ // consider all the queens
-            _BitScanForward64(&square, piece); // find position of queen and assign it to square
-            hash_index_bishop = bishop_hash_index(pos.all_pieces, square, n_attacks_bishop);
-            attacks = bishop_covered_squares_bitboards[hash_index_bishop];
-            attacks &= ~pos.white_pieces; // excluse self-capture
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.black_pieces, target_square);
-                is_capture ? flags = 4 : flags = 0;
-                moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                move_index++;
-                clear_last_active_bit(attacks); 
-            }
-            clear_last_active_bit(piece);
-        }
+template<Color Us>
+void PseudoLegalMoves(const Position& pos, MoveNew* moves, GenType type){
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    constexpr int pawn_push = ColorTraits<Us>::pawn_push;
+    constexpr int promotion_rank = ColorTraits<Us>::promotion_rank;
+    constexpr uint8_t king_home = ColorTraits<Us>::king_home;
+    uint8_t move_index = 0;
+    uint64_t piece;
+    unsigned long square, target_square;
+    uint64_t attacks;
+    uint16_t flags;
 
-        // Knight
-        piece = pos.pieces[4]; // retrieve bitboard of knights
-        while(piece){ // consider all the knights
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            is_capture = bit_get(pos.black_pieces, target_square);
-            attacks = knight_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.white_pieces; // exclude self-capture
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.black_pieces, target_square);
-                is_capture ? flags = 4 : flags = 0;
-                moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                move_index++;
-                clear_last_active_bit(attacks); 
-            }
-            // remove considered piece
-            clear_last_active_bit(piece);
-        }
+    // restrict the target squares to the requested type of moves (see GenType) before generating them:
+    // enemy pieces for captures, empty squares for quiet moves, anything but friendly pieces for all the moves
+    const uint64_t friendly_pieces = PiecesOf<Us>(pos);
+    const uint64_t enemy_pieces = PiecesOf<~Us>(pos);
+    const uint64_t type_mask = (type == CAPTURES) ? enemy_pieces : (type == QUIETS) ? ~pos.all_pieces : ~friendly_pieces;
+    // pawns: captures are not quiet moves, and pushes are quiet unless they promote
+    const uint64_t pawn_capture_mask = (type == QUIETS) ? 0ULL : ~0ULL;
+    const uint64_t pawn_push_mask = (type == CAPTURES) ? ranks_bitboards[promotion_rank] : (type == QUIETS) ? ~ranks_bitboards[promotion_rank] : ~0ULL;
 
-        // Pawn capture
-        piece = pos.pieces[5];
+    // King, Queen, Rook, Bishop, Knight
+    for(uint8_t piece_index = friendly; piece_index < friendly + 5; piece_index++){
+        piece = pos.pieces[piece_index];
         while(piece){
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            // NORMAL CAPTURES
-            attacks = white_pawn_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= pos.black_pieces; // only attacked squares occupied by enemy pieces are valid for movement
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                // in case of promotion, loop over all possible promoted pieces
-                if(target_square / 8 == 0){
-                    for(uint8_t promoted_piece_index = 1; promoted_piece_index < 5; promoted_piece_index++){
-                        flags = 16 - promoted_piece_index;
-                        moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                        move_index++;
-                    }
-                }
-                else{ 
-                    flags = 4;
-                    moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                    move_index++;
-                }
-                clear_last_active_bit(attacks); // remove considered attack
+            // find position of piece and assign it to square
+            square = get_last_active_bit(piece);
+            // retrieve attack bitboard
+            if(piece_index == friendly){
+                attacks = king_covered_squares_bitboards[square];
             }
-            // EN PASSANT CAPTURES
-            attacks = white_pawn_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= pos.en_passant_target_square; // only attacked squares occupied by enemy pieces are valid for movement
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square            
-                flags = 5;
-                moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                move_index++;
-                clear_last_active_bit(attacks); // remove considered attack
+            else if(piece_index == friendly + 4){
+                attacks = knight_covered_squares_bitboards[square];
             }
-
-            // Pawn push
-            attacks = white_pawn_advance_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.all_pieces; // control that there are no blockers in front
-            // problem: so far, if a piece is in front of the pawn and the pawn is in the starting rank, it can still advance 2 squares!
-            // everything is ok if the attack bitboard looks like this (1-square push and 2-square push both possible)
-            // .............
-            // ... 0 1 0 ...
-            // ... 0 1 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // or like this (single push is possible, double push is not)
-            // .............
-            // ... 0 0 0 ...
-            // ... 0 1 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // but a bitboard like this is not acceptable (2-square push is possible, 1-square push is not):
-            // .............
-            // ... 0 1 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // (of course the latter is an acceptable bitboard if the pawn starting square is in the 3rd rank)
-            if((square/8 == 6) && !bit_get(attacks, square - 8) && bit_get(attacks, square - 16)){
+            else{
                 attacks = 0ULL;
-            }
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                // in case of promotion, loop over all possible promoted pieces
-                if(target_square / 8 == 0){
-                    for(uint8_t promoted_piece_index = 1; promoted_piece_index < 5; promoted_piece_index++){
-                        flags = 12 - promoted_piece_index;
-                        moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                        move_index++;
-                    }
+                if(piece_index != friendly + 3){ // queen or rook
+                    attacks |= rook_attacks(pos.all_pieces, square);
                 }
-                // if this is a double push, flag it to manage en-passant target squares later
-                else if(target_square / 8 == 4 && square / 8 == 6){
-                    flags = 1;
-                    moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                    move_index++;
+                if(piece_index != friendly + 2){ // queen or bishop
+                    attacks |= bishop_attacks(pos.all_pieces, square);
                 }
-                else{
-                    flags = 0;
-                    moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                    move_index++;
-                }
-                clear_last_active_bit(attacks); // remove considered attack
             }
-            // remove considered piece
-            clear_last_active_bit(piece);
-        }
-
-        // Castles kingside
-        // here I am nesting if statements, because if one of them fails there's no need to go ahead and check all the other conditions
-        // the conditions involving bit_get() require a few bitwise operations, which we can confortably skip in many positions
-        if(pos.can_white_castle_kingside){ // 1. you still have right to castle from game history
-            if(!bit_get(pos.all_pieces, 61) && 
-                !bit_get(pos.all_pieces, 62)){ // 2. the in-between squares are empty
-                // 3. king does not pass through a square covered by opponent
-                if(bit_get(pos.pieces[0], 60) &&
-                    bit_get(pos.pieces[2], 63)){ // 4. king and rook are in the correct position
-                    moves[move_index] = EncodeMoveNew(60, 62, 2); 
-                    move_index++;
-                } 
-            }   
-        }
-        // Castles queenside
-        if(pos.can_white_castle_queenside){ 
-            if(!bit_get(pos.all_pieces, 59) && 
-                !bit_get(pos.all_pieces, 58) &&
-                !bit_get(pos.all_pieces, 57)){ 
-                if(bit_get(pos.pieces[0], 60) &&
-                    bit_get(pos.pieces[2], 56)){ 
-                    moves[move_index] = EncodeMove(60, 58, 3); 
-                    move_index++;
-                } 
-            }   
-        }
-    }
-
-    // BLACK MOVES
-    else{
-
-        // King
-        piece = pos.pieces[6];
-        while(piece){
-            // find position of piece and assign it to square
-            _BitScanForward64(&square, piece); 
-            attacks = king_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.black_pieces; // exclude self-capture
+            attacks &= type_mask; // exclude self-capture (and the moves of the other type)
             while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.white_pieces, target_square);
-                is_capture ? flags = 4 : flags = 0;
+                target_square = get_last_active_bit(attacks); // find the target square
+                flags = bit_get(enemy_pieces, target_square) ? 4 : 0;
                 // save the move
                 moves[move_index] = EncodeMoveNew(square, target_square, flags);
                 move_index++;
                 // remove considered attack
-                clear_last_active_bit(attacks); 
+                clear_last_active_bit(attacks);
             }
             // remove considered piece
             clear_last_active_bit(piece);
         }
+    }
 
-        // Queen
-        piece = pos.pieces[7]; // retrieve bitboard of queens
-        while(piece){ // consider all the queens
-            _BitScanForward64(&square, piece); // find position of queen and assign it to square
-            // retrieve bitboard of queen moves
-            hash_index_rook = rook_hash_index(pos.all_pieces, square, n_attacks_rook);
-            hash_index_bishop = bishop_hash_index(pos.all_pieces, square, n_attacks_bishop);
-            attacks = rook_covered_squares_bitboards[hash_index_rook] | bishop_covered_squares_bitboards[hash_index_bishop];
-            attacks &= ~pos.black_pieces; // excluse self-capture
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.white_pieces, target_square);
-                is_capture ? flags = 4 : flags = 0;
-                moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                move_index++;
-                clear_last_active_bit(attacks); 
-            }
-            clear_last_active_bit(piece);
-        }
-
-        // Rook
-        piece = pos.pieces[8];
-        while(piece){
-            _BitScanForward64(&square, piece); // find position of queen and assign it to square
-            // retrieve bitboard of queen moves
-            hash_index_rook = rook_hash_index(pos.all_pieces, square, n_attacks_rook);
-            attacks = rook_covered_squares_bitboards[hash_index_rook];
-            attacks &= ~pos.black_pieces; // excluse self-capture
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.white_pieces, target_square);
-                is_capture ? flags = 4 : flags = 0;
-                moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                move_index++;
-                clear_last_active_bit(attacks); 
-            }
-            clear_last_active_bit(piece);
-        }
-
-        // Bishop
-        piece = pos.pieces[9]; // retrieve bitboard of queens
-        while(piece){ // consider all the queens
-            _BitScanForward64(&square, piece); // find position of queen and assign it to square
-            hash_index_bishop = bishop_hash_index(pos.all_pieces, square, n_attacks_bishop);
-            attacks = bishop_covered_squares_bitboards[hash_index_bishop];
-            attacks &= ~pos.black_pieces; // excluse self-capture
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.white_pieces, target_square);
-                is_capture ? flags = 4 : flags = 0;
-                moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                move_index++;
-                clear_last_active_bit(attacks); 
-            }
-            clear_last_active_bit(piece);
-        }
-
-        // Knight
-        piece = pos.pieces[10]; // retrieve bitboard of knights
-        while(piece){ // consider all the knights
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            is_capture = bit_get(pos.white_pieces, target_square);
-            attacks = knight_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.black_pieces; // exclude self-capture
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.white_pieces, target_square);
-                is_capture ? flags = 4 : flags = 0;
-                moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                move_index++;
-                clear_last_active_bit(attacks); 
-            }
-            // remove considered piece
-            clear_last_active_bit(piece);
-        }
+    // Pawns: pushes, double pushes and captures of all the pawns at once (promotions included)
+    AddPawnMovesSetwise<Us>(pos, moves, move_index, pos.pieces[friendly + 5], pawn_push_mask, pawn_capture_mask);
+    // en-passant captures: the pawns are shifted onto the en-passant target square as for the normal captures
+    const uint64_t en_passant_mask = pos.en_passant_target_square & pawn_capture_mask;
+    AddPawnMoves<pawn_push - 1>(moves, move_index, shift_bitboard<pawn_push - 1>(pos.pieces[friendly + 5]) & en_passant_mask, 5, promotion_rank);
+    AddPawnMoves<pawn_push + 1>(moves, move_index, shift_bitboard<pawn_push + 1>(pos.pieces[friendly + 5]) & en_passant_mask, 5, promotion_rank);
 
-        // Pawn capture
-        piece = pos.pieces[11];
-        while(piece){
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            // NORMAL CAPTURES
-            attacks = black_pawn_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= pos.white_pieces; // only attacked squares occupied by enemy pieces are valid for movement
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                // in case of promotion, loop over all possible promoted pieces
-                if(target_square / 8 == 7){
-                    for(uint8_t promoted_piece_index = 7; promoted_piece_index < 11; promoted_piece_index++){
-                        flags = 22 - promoted_piece_index;
-                        moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                        move_index++;
-                    }
-                }
-                else{ 
-                    flags = 4;
-                    moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                    move_index++;
-                }
-                clear_last_active_bit(attacks); // remove considered attack
-            }
-            // EN PASSANT CAPTURES
-            attacks = black_pawn_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= pos.en_passant_target_square; // only attacked squares occupied by enemy pieces are valid for movement
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                flags = 5;
-                moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                move_index++;
-                clear_last_active_bit(attacks); // remove considered attack
-            }
-
-            // Pawn push
-            attacks = black_pawn_advance_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.all_pieces; // control that there are no blockers in front
-            // problem: so far, if a piece is in front of the pawn and the pawn is in the starting rank, it can still advance 2 squares!
-            // everything is ok if the attack bitboard looks like this (1-square push and 2-square push both possible)
-            // .............
-            // ... 0 1 0 ...
-            // ... 0 1 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // or like this (single push is possible, double push is not)
-            // .............
-            // ... 0 0 0 ...
-            // ... 0 1 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // but a bitboard like this is not acceptable (2-square push is possible, 1-square push is not):
-            // .............
-            // ... 0 1 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // (of course the latter is an acceptable bitboard if the pawn starting square is in the 3rd rank)
-            if((square/8 == 1) && !bit_get(attacks, square + 8) && bit_get(attacks, square + 16)){
-                attacks = 0ULL;
-            }
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                // in case of promotion, loop over all possible promoted pieces
-                if(target_square / 8 == 7){
-                    for(uint8_t promoted_piece_index = 7; promoted_piece_index < 11; promoted_piece_index++){
-                        flags = 22 - promoted_piece_index;
-                        moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                        move_index++;
-                    }
-                }
-                // if this is a double push, flag it to manage en-passant target squares later
-                else if(target_square / 8 == 3 && square / 8 == 1){
-                    flags = 1;
-                    moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                    move_index++;
-                }
-                else{
-                    flags = 0;
-                    moves[move_index] = EncodeMoveNew(square, target_square, flags);
-                    move_index++;
-                }
-                clear_last_active_bit(attacks); // remove considered attack
-            }
-            // remove considered piece
-            clear_last_active_bit(piece);
+    // Castles
+    // 1. you still have right to castle from game history
+    // 2. the in-between squares are empty
+    // 3. king and rook are in the correct position
+    // (whether the king passes through a square covered by the opponent is checked later in IsLegal)
+    if(type != CAPTURES){
+        if(CanCastleKingside<Us>(pos) && (pos.all_pieces & (3ULL << (king_home + 1))) == 0 &&
+            bit_get(pos.pieces[friendly], king_home) && bit_get(pos.pieces[friendly + 2], ColorTraits<Us>::kingside_rook_home)){
+            moves[move_index] = EncodeMoveNew(king_home, king_home + 2, 2);
+            move_index++;
+        }
+        if(CanCastleQueenside<Us>(pos) && (pos.all_pieces & (7ULL << (king_home - 3))) == 0 &&
+            bit_get(pos.pieces[friendly], king_home) && bit_get(pos.pieces[friendly + 2], ColorTraits<Us>::queenside_rook_home)){
+            moves[move_index] = EncodeMoveNew(king_home, king_home - 2, 3);
+            move_index++;
         }
+    }
+}
 
-        // Castles kingside
-        // here I am nesting if statements, because if one of them fails there's no need to go ahead and check all the other conditions
-        // the conditions involving bit_get() require a few bitwise operations, which we can confortably skip in many positions
-        if(pos.can_black_castle_kingside){ 
-            if(!bit_get(pos.all_pieces, 5) && 
-                !bit_get(pos.all_pieces, 6)){ 
-                if(bit_get(pos.pieces[6], 4) &&
-                    bit_get(pos.pieces[8], 7)){ 
-                    moves[move_index] = EncodeMoveNew(4, 6, 2);
-                    move_index++;
-                } 
-            }   
-        }
+template void PseudoLegalMoves<WHITE>(const Position& pos, MoveNew* moves, GenType type);
+template void PseudoLegalMoves<BLACK>(const Position& pos, MoveNew* moves, GenType type);
 
-        // Castles queenside
-        if(pos.can_black_castle_queenside){ 
-            if(!bit_get(pos.all_pieces, 3) && 
-                !bit_get(pos.all_pieces, 2) &&
-                !bit_get(pos.all_pieces, 1)){ 
-                if(bit_get(pos.pieces[6], 4) &&
-                    bit_get(pos.pieces[8], 0)){ 
-                    moves[move_index] = EncodeMoveNew(4, 2, 3); 
-                    move_index++;
-                } 
-            }   
-        }
-    }
+void PseudoLegalMoves(const Position& pos, MoveNew* moves, GenType type){
+    pos.white_to_move ? PseudoLegalMoves<WHITE>(pos, moves, type) : PseudoLegalMoves<BLACK>(pos, moves, type);
 }
 
 
-void MakeMove(Position& pos, const MoveNew& move, StateMemory& state){
+template<Color Us>
+void MakeMove(Position& pos, const MoveNew& move, UndoStack& undo){
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    constexpr uint8_t enemy = ColorTraits<Us>::enemy;
+    constexpr int pawn_push = ColorTraits<Us>::pawn_push;
+    constexpr uint8_t king_home = ColorTraits<Us>::king_home;
     uint8_t from, to, flags;
-    uint8_t moved_piece_index = 0, captured_piece_index = 12, promoted_piece_index = 12; // 12 = no piece captured
+    uint8_t moved_piece_index, captured_piece_index, promoted_piece_index = NO_PIECE;
+    uint64_t& friendly_pieces = PiecesOf<Us>(pos);
+    uint64_t& enemy_pieces = PiecesOf<~Us>(pos);
     // retrieve info from the move
     from = move & 0b00111111;
     to = (move >> 6) & 0b00111111;
     flags = (move >> 12);
-    // WHITE TO MOVE
-    if(pos.white_to_move){
-        // retrieve what piece has moved
-        for(uint8_t piece_index = 0; piece_index < 6; piece_index++){
-            if(bit_get_opt(pos.pieces[piece_index], from)){
-                moved_piece_index = piece_index;
-                break;
-            }
-        }
-        // retrieve info about captured piece (if any)
-        for(uint8_t piece_index = 6; piece_index < 12; piece_index++){
-            // standard capture
-            if(bit_get_opt(pos.pieces[piece_index], to)){
-                captured_piece_index = piece_index;
-                break;
-            } 
-            // en-passant capture
-            else if(flags == 5){
-                captured_piece_index = 11; // <--- necessarily a pawn
-                break;
-            }
-        }
-        // update en passant target
-        state.en_passant_target_square = pos.en_passant_target_square;
-        if(flags == 1){ // double pawn push
-            pos.en_passant_target_square = 1ULL << (to + 8);
-        }
-        else{
-            pos.en_passant_target_square = 0ULL;
-        }
-        // retrieve info about promoted piece (if any)
-        if(flags == 11 || flags == 15){ promoted_piece_index = 1; } // queen
-        else if(flags == 10 || flags == 14){ promoted_piece_index = 2; } // rook
-        else if(flags == 9 || flags == 13){ promoted_piece_index = 3; } // bishop
-        else if(flags == 8 || flags == 12){ promoted_piece_index = 4; } // knight
-        // save current state
-        state.moved_piece_index = moved_piece_index;
-        state.captured_piece_index = captured_piece_index;
-        state.friendly_pieces = pos.white_pieces;
-        state.enemy_pieces = pos.black_pieces;
-        state.captured_piece = pos.pieces[captured_piece_index];
-        // remove the piece from the starting square
-        bit_clear_opt(pos.pieces[moved_piece_index], from);
-        bit_clear_opt(pos.white_pieces, from);
-        // spawn the moved piece on the target square
-        bit_set_opt(pos.pieces[moved_piece_index], to);
-        bit_set_opt(pos.white_pieces, to);
-        // remove captured piece, if any
-        if(captured_piece_index != 12){
-            // if en passant, piece is not in the target square
-            if(flags == 5){
-                bit_clear_opt(pos.pieces[11], to + 8);
-                bit_clear_opt(pos.black_pieces, to + 8);
-            }
-            else{
-                bit_clear_opt(pos.pieces[captured_piece_index], to);
-                bit_clear_opt(pos.black_pieces, to);
-            }
-        }
-        // spawn the promoted piece in case of promotion and remove the pawn
-        if(promoted_piece_index != 12){
-            bit_clear_opt(pos.pieces[5], to);
-            bit_set_opt(pos.pieces[promoted_piece_index], to);
-        }
-        // Handle castling
-        if(flags == 2){// kingside castle
-            // transfer the rook
-            bit_clear_opt(pos.pieces[2], 63); bit_set_opt(pos.pieces[2], 61);
-            bit_clear_opt(pos.white_pieces, 63); bit_set_opt(pos.white_pieces, 61);
-        }
-        else if(flags == 3){// queenside castle
-            // transfer the rook
-            bit_clear_opt(pos.pieces[2], 56); bit_set_opt(pos.pieces[2], 59);
-            bit_clear_opt(pos.white_pieces, 56); bit_set_opt(pos.white_pieces, 59);
-        }
+    // push the irreversible info of the current position on the undo stack
+    assert(undo.ply < MAX_PLY);
+    StateMemory& state = undo.states[undo.ply];
+    undo.ply++;
+    state.en_passant_target_square = pos.en_passant_target_square;
+    state.half_move_counter = pos.half_move_counter;
+    state.can_white_castle_kingside = pos.can_white_castle_kingside;
+    state.can_white_castle_queenside = pos.can_white_castle_queenside;
+    state.can_black_castle_kingside = pos.can_black_castle_kingside;
+    state.can_black_castle_queenside = pos.can_black_castle_queenside;
+    // HASH: switch side to move and remove castling rights and en-passant file of the current position
+    // (the ones of the new position are added back at the end)
+    pos.hash ^= zobrist_table.white_to_move ^ ZobristCastling(pos) ^ ZobristEnPassant(pos);
 
-        // CASTLING RIGHTS
-        // save current castling rights 
-        state.can_white_castle_kingside = pos.can_white_castle_kingside;
-        state.can_white_castle_queenside = pos.can_white_castle_queenside;
-        // loose castling rights if current move is castling or king move 
-        if(flags == 2 || flags == 3 || moved_piece_index == 0){
-            pos.can_white_castle_kingside = false;
-            pos.can_white_castle_queenside = false;
-        }
-        // if you move the rook on h1 
-        if(moved_piece_index == 2 && from == 63){
-            pos.can_white_castle_kingside = false;
-        }
-        // if you move the rook on a1
-        if(moved_piece_index == 2 && from == 56){
-            pos.can_white_castle_queenside = false;
-        }
-
-        // increment half move counter in case of capture or pawn move
-        if(captured_piece_index != 12 || moved_piece_index == 5){
-            state.half_move_counter = pos.half_move_counter;
-            pos.half_move_counter = 0;
-        }
-        else{ pos.half_move_counter++; }
-        // update bitboards
-        pos.all_pieces = pos.white_pieces | pos.black_pieces;
-        // update side to move
-        pos.white_to_move = false;
+    // retrieve what piece has moved and what piece is captured (if any) from the mailbox board
+    moved_piece_index = pos.piece_on[from];
+    captured_piece_index = pos.piece_on[to];
+    // en-passant capture: the target square is empty, the captured piece is necessarily a pawn
+    if(flags == 5){ captured_piece_index = enemy + 5; }
+    // update en passant target: the square behind the pawn that made a double push
+    if(flags == 1){
+        pos.en_passant_target_square = 1ULL << (to - pawn_push);
     }
-
-    // BLACK TO MOVE
     else{
-        // retrieve what piece has moved
-        for(uint8_t piece_index = 6; piece_index < 12; piece_index++){
-            if(bit_get_opt(pos.pieces[piece_index], from)){
-                moved_piece_index = piece_index;
-                break;
-            }
-        }
-        // retrieve info about captured piece (if any)
-        for(uint8_t piece_index = 0; piece_index < 6; piece_index++){
-            // standard capture
-            if(bit_get_opt(pos.pieces[piece_index], to)){
-                captured_piece_index = piece_index;
-                break;
-            } 
-            // en-passant capture
-            else if(flags == 5){
-                captured_piece_index = 5; // <--- necessarily a pawn
-                break;
-            }
-        }
-        // update en passant target
-        state.en_passant_target_square = pos.en_passant_target_square;
-        if(flags == 1){ // double pawn push
-            pos.en_passant_target_square = 1ULL << (to - 8);
+        pos.en_passant_target_square = 0ULL;
+    }
+    // retrieve info about promoted piece (if any): 11 = Q, 10 = R, 9 = B, 8 = N (+4 if capture)
+    if(flags >= 8){ promoted_piece_index = friendly + 4 - (flags & 0b0011); }
+    // save captured piece
+    state.captured_piece_index = captured_piece_index;
+    // remove the piece from the starting square
+    bit_clear_opt(pos.pieces[moved_piece_index], from);
+    bit_clear_opt(friendly_pieces, from);
+    // spawn the moved piece on the target square
+    bit_set_opt(pos.pieces[moved_piece_index], to);
+    bit_set_opt(friendly_pieces, to);
+    pos.hash ^= zobrist_table.pieces_and_squares[moved_piece_index][from] ^ zobrist_table.pieces_and_squares[moved_piece_index][to];
+    pos.piece_on[from] = NO_PIECE;
+    pos.piece_on[to] = moved_piece_index;
+    // remove captured piece, if any
+    if(captured_piece_index != NO_PIECE){
+        // if en passant, piece is not in the target square
+        if(flags == 5){
+            bit_clear_opt(pos.pieces[enemy + 5], to - pawn_push);
+            pos.piece_on[to - pawn_push] = NO_PIECE;
+            bit_clear_opt(enemy_pieces, to - pawn_push);
+            pos.hash ^= zobrist_table.pieces_and_squares[enemy + 5][to - pawn_push];
         }
         else{
-            pos.en_passant_target_square = 0ULL;
-        }
-        // retrieve info about promoted piece (if any)
-        if(flags == 11 || flags == 15){ promoted_piece_index = 7; } // queen
-        else if(flags == 10 || flags == 14){ promoted_piece_index = 8; } // rook
-        else if(flags == 9 || flags == 13){ promoted_piece_index = 9; } // bishop
-        else if(flags == 8 || flags == 12){ promoted_piece_index = 10; } // knight
-        // memorize current state
-        state.moved_piece_index = moved_piece_index;
-        state.captured_piece_index = captured_piece_index;
-        state.friendly_pieces = pos.black_pieces;
-        state.enemy_pieces = pos.white_pieces;
-        state.captured_piece = pos.pieces[captured_piece_index];
-        // remove the piece from the starting square
-        bit_clear_opt(pos.pieces[moved_piece_index], from);
-        bit_clear_opt(pos.black_pieces, from);
-        // spawn the moved piece on the target square
-        bit_set_opt(pos.pieces[moved_piece_index], to);
-        bit_set_opt(pos.black_pieces, to);
-        // remove captured piece, if any
-        if(captured_piece_index != 12){
-            // if en passant, piece is not in the target square
-            if(flags == 5){
-                bit_clear_opt(pos.pieces[5], to - 8);
-                bit_clear_opt(pos.white_pieces, to - 8);
-            }
-            else{
-                bit_clear_opt(pos.pieces[captured_piece_index], to);
-                bit_clear_opt(pos.white_pieces, to);
-            }
-        }
-        // spawn the promoted piece in case of promotion and remove the pawn
-        if(promoted_piece_index != 12){
-            bit_clear_opt(pos.pieces[11], to);
-            bit_set_opt(pos.pieces[promoted_piece_index], to);
-        }
-        // Handle castling
-        if(flags == 2){// kingside castle
-            // transfer the rook
-            bit_clear_opt(pos.pieces[8], 7); bit_set_opt(pos.pieces[8], 5);
-            bit_clear_opt(pos.black_pieces, 7); bit_set_opt(pos.black_pieces, 5);
-        }
-        else if(flags == 3){// queenside castle
-            // transfer the rook
-            bit_clear_opt(pos.pieces[8], 0); bit_set_opt(pos.pieces[8], 3);
-            bit_clear_opt(pos.black_pieces, 0); bit_set_opt(pos.black_pieces, 3);
-        }
-        // CASTLING RIGHTS
-        // save current castling rights 
-        state.can_black_castle_kingside = pos.can_black_castle_kingside;
-        state.can_black_castle_queenside = pos.can_black_castle_queenside;
-        // loose castling rights if current move is castling or king move 
-        if(flags == 2 || flags == 3 || moved_piece_index == 6){
-            pos.can_black_castle_kingside = false;
-            pos.can_black_castle_queenside = false;
-        }
-        // if you move the rook on h8 
-        if(moved_piece_index == 8 && from == 7){
-            pos.can_black_castle_kingside = false;
-        }
-        // if you move the rook on a8
-        if(moved_piece_index == 8 && from == 0){
-            pos.can_black_castle_queenside = false;
-        }
-        // Reset half move counter in case of capture or pawn move
-        if(captured_piece_index != 12 || moved_piece_index == 11){
-            state.half_move_counter = pos.half_move_counter;
-            pos.half_move_counter = 0;
+            bit_clear_opt(pos.pieces[captured_piece_index], to);
+            bit_clear_opt(enemy_pieces, to);
+            pos.hash ^= zobrist_table.pieces_and_squares[captured_piece_index][to];
         }
-        // ...or else increment it 
-        else{ pos.half_move_counter++; }
-        // update bitboards
-        pos.all_pieces = pos.white_pieces | pos.black_pieces;
-        // update side to move
-        pos.white_to_move = true;
     }
+    // spawn the promoted piece in case of promotion and remove the pawn
+    if(promoted_piece_index != NO_PIECE){
+        bit_clear_opt(pos.pieces[friendly + 5], to);
+        bit_set_opt(pos.pieces[promoted_piece_index], to);
+        pos.piece_on[to] = promoted_piece_index;
+        pos.hash ^= zobrist_table.pieces_and_squares[friendly + 5][to] ^ zobrist_table.pieces_and_squares[promoted_piece_index][to];
+    }
+    // Handle castling: transfer the rook
+    if(flags == 2 || flags == 3){
+        const uint8_t rook_from = (flags == 2) ? ColorTraits<Us>::kingside_rook_home : ColorTraits<Us>::queenside_rook_home;
+        const uint8_t rook_to = (flags == 2) ? king_home + 1 : king_home - 1;
+        bit_clear_opt(pos.pieces[friendly + 2], rook_from); bit_set_opt(pos.pieces[friendly + 2], rook_to);
+        pos.hash ^= zobrist_table.pieces_and_squares[friendly + 2][rook_from] ^ zobrist_table.pieces_and_squares[friendly + 2][rook_to];
+        pos.piece_on[rook_from] = NO_PIECE; pos.piece_on[rook_to] = friendly + 2;
+        bit_clear_opt(friendly_pieces, rook_from); bit_set_opt(friendly_pieces, rook_to);
+    }
+
+    // CASTLING RIGHTS
+    // loose castling rights if current move is castling or king move
+    if(flags == 2 || flags == 3 || moved_piece_index == friendly){
+        CanCastleKingside<Us>(pos) = false;
+        CanCastleQueenside<Us>(pos) = false;
+    }
+    // if you move the rook on h1 (h8 for black)
+    if(moved_piece_index == friendly + 2 && from == ColorTraits<Us>::kingside_rook_home){
+        CanCastleKingside<Us>(pos) = false;
+    }
+    // if you move the rook on a1 (a8 for black)
+    if(moved_piece_index == friendly + 2 && from == ColorTraits<Us>::queenside_rook_home){
+        CanCastleQueenside<Us>(pos) = false;
+    }
+
+    // reset half move counter in case of capture or pawn move...
+    if(captured_piece_index != NO_PIECE || moved_piece_index == friendly + 5){
+        pos.half_move_counter = 0;
+    }
+    // ...or else increment it
+    else{ pos.half_move_counter++; }
+    // update bitboards
+    pos.all_pieces = pos.white_pieces | pos.black_pieces;
+    // update side to move
+    pos.white_to_move = (Us == BLACK);
+    // HASH: add castling rights and en-passant file of the new position
+    pos.hash ^= ZobristCastling(pos) ^ ZobristEnPassant(pos);
+    // debug check: the incremental key must match the full computation
+    assert(pos.hash == ZobristHashing(pos));
 }
 
-void UnmakeMove(Position& pos, const MoveNew& move, const StateMemory& state){
-    uint8_t from, to, flags;
-    uint8_t promoted_piece_index = 12;
+template void MakeMove<WHITE>(Position& pos, const MoveNew& move, UndoStack& undo);
+template void MakeMove<BLACK>(Position& pos, const MoveNew& move, UndoStack& undo);
+
+void MakeMove(Position& pos, const MoveNew& move, UndoStack& undo){
+    pos.white_to_move ? MakeMove<WHITE>(pos, move, undo) : MakeMove<BLACK>(pos, move, undo);
+}
+
+template<Color Us>
+void UnmakeMove(Position& pos, const MoveNew& move, UndoStack& undo){
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    constexpr int pawn_push = ColorTraits<Us>::pawn_push;
+    constexpr uint8_t king_home = ColorTraits<Us>::king_home;
+    uint8_t from, to, flags, captured_square;
+    uint8_t moved_piece_index, promoted_piece_index;
+    uint64_t& friendly_pieces = PiecesOf<Us>(pos);
+    uint64_t& enemy_pieces = PiecesOf<~Us>(pos);
     from = move & 0b00111111;
     to = (move >> 6) & 0b00111111;
     flags = (move >> 12);
+    // pop the irreversible info of the previous position from the undo stack
+    assert(undo.ply > 0);
+    undo.ply--;
+    const StateMemory& state = undo.states[undo.ply];
+    // HASH: switch side to move and remove castling rights and en-passant file of the current position
+    pos.hash ^= zobrist_table.white_to_move ^ ZobristCastling(pos) ^ ZobristEnPassant(pos);
+    // the captured piece was on the target square, or behind it in case of en-passant
+    captured_square = (flags == 5) ? to - pawn_push : to;
+
+    // remove promoted piece and restore the pawn: 11 = Q, 10 = R, 9 = B, 8 = N (+4 if capture)
+    if(flags >= 8){
+        promoted_piece_index = friendly + 4 - (flags & 0b0011);
+        bit_clear_opt(pos.pieces[promoted_piece_index], to);
+        bit_set_opt(pos.pieces[friendly + 5], to);
+        pos.hash ^= zobrist_table.pieces_and_squares[promoted_piece_index][to] ^ zobrist_table.pieces_and_squares[friendly + 5][to];
+        pos.piece_on[to] = friendly + 5;
+    }
     // reposition the moved piece
-    bit_clear_opt(pos.pieces[state.moved_piece_index], to);
-    bit_set_opt(pos.pieces[state.moved_piece_index], from);
-
-    // black made the pseudomove
-    if(pos.white_to_move){
-        // reposition the captured piece
-        if(state.captured_piece_index != 12){
-            pos.pieces[state.captured_piece_index] = state.captured_piece;
-        }
-        // remove promoted piece and restore the pawn 
-        if(flags == 11 || flags == 15){ promoted_piece_index = 7; } // queen
-        else if(flags == 10 || flags == 14){ promoted_piece_index = 8; } // rook
-        else if(flags == 9 || flags == 13){ promoted_piece_index = 9; } // bishop
-        else if(flags == 8 || flags == 12){ promoted_piece_index = 10; } // knight
-        if(promoted_piece_index != 12){
-            bit_clear_opt(pos.pieces[promoted_piece_index], to);
-            bit_set_opt(pos.pieces[11], from);
-        }
-        // in case of castling, reposition the rook correctly
-        if(flags == 2){ // kingside
-            bit_clear_opt(pos.pieces[8], 5);
-            bit_set_opt(pos.pieces[8], 7);
-        }
-        else if(flags == 3){ // queenside
-            bit_clear_opt(pos.pieces[8], 3);
-            bit_set_opt(pos.pieces[8], 0);
-        }
-        // restore group bitboards
-        pos.white_pieces = state.enemy_pieces;
-        pos.black_pieces = state.friendly_pieces;
-        pos.all_pieces = pos.white_pieces | pos.black_pieces;
-        // restore previous castling rights
-        pos.can_black_castle_kingside = state.can_black_castle_kingside;
-        pos.can_black_castle_queenside = state.can_black_castle_queenside;
-        // restore half-move counter
-        if(state.captured_piece_index != 12 || state.moved_piece_index == 11){
-            pos.half_move_counter = state.half_move_counter;
-        }
-        else{ pos.half_move_counter--; }
-        // restore en-passant target square
-        pos.en_passant_target_square = state.en_passant_target_square;
-        // update side to move
-        pos.white_to_move = false;
+    moved_piece_index = pos.piece_on[to];
+    bit_clear_opt(pos.pieces[moved_piece_index], to); bit_set_opt(pos.pieces[moved_piece_index], from);
+    bit_clear_opt(friendly_pieces, to); bit_set_opt(friendly_pieces, from);
+    pos.hash ^= zobrist_table.pieces_and_squares[moved_piece_index][to] ^ zobrist_table.pieces_and_squares[moved_piece_index][from];
+    pos.piece_on[to] = NO_PIECE; pos.piece_on[from] = moved_piece_index;
+    // reposition the captured piece
+    if(state.captured_piece_index != NO_PIECE){
+        bit_set_opt(pos.pieces[state.captured_piece_index], captured_square);
+        bit_set_opt(enemy_pieces, captured_square);
+        pos.hash ^= zobrist_table.pieces_and_squares[state.captured_piece_index][captured_square];
+        pos.piece_on[captured_square] = state.captured_piece_index;
     }
-
-    // if white made the pseudomove 
-    else{
-        // reposition the captured piece
-        if(state.captured_piece_index != 12){
-            pos.pieces[state.captured_piece_index] = state.captured_piece;
-        }
-        // remove promoted piece and restore the pawn 
-        if(flags == 11 || flags == 15){ promoted_piece_index = 1; } // queen
-        else if(flags == 10 || flags == 14){ promoted_piece_index = 2; } // rook
-        else if(flags == 9 || flags == 13){ promoted_piece_index = 3; } // bishop
-        else if(flags == 8 || flags == 12){ promoted_piece_index = 4; } // knight
-        if(promoted_piece_index != 12){
-            bit_clear_opt(pos.pieces[promoted_piece_index], to);
-            bit_set_opt(pos.pieces[5], from);
-        }
-        // in case of castling, reposition the rook correctly
-        if(flags == 2){ // kingside
-            bit_clear_opt(pos.pieces[2], 61);
-            bit_set_opt(pos.pieces[2], 63);
-        }
-        else if(flags == 3){// queenside
-            bit_clear_opt(pos.pieces[2], 59);
-            bit_set_opt(pos.pieces[2], 56);
-        }
-        // restore group bitboards
-        pos.white_pieces = state.friendly_pieces;
-        pos.black_pieces = state.enemy_pieces;
-        pos.all_pieces = pos.white_pieces | pos.black_pieces;
-        // restore previous castling rights
-        pos.can_white_castle_kingside = state.can_white_castle_kingside;
-        pos.can_white_castle_queenside = state.can_white_castle_queenside;
-        // restore half-move counter
-        if(state.captured_piece_index != 12 || state.moved_piece_index == 5){
-            pos.half_move_counter = state.half_move_counter;
-        }
-        else{ pos.half_move_counter--; }
-        // restore en-passant target
-        pos.en_passant_target_square = state.en_passant_target_square;
-        // update side to move
-        pos.white_to_move = true;
+    // in case of castling, reposition the rook correctly
+    if(flags == 2 || flags == 3){
+        const uint8_t rook_from = (flags == 2) ? ColorTraits<Us>::kingside_rook_home : ColorTraits<Us>::queenside_rook_home;
+        const uint8_t rook_to = (flags == 2) ? king_home + 1 : king_home - 1;
+        bit_clear_opt(pos.pieces[friendly + 2], rook_to);
+        bit_set_opt(pos.pieces[friendly + 2], rook_from);
+        pos.hash ^= zobrist_table.pieces_and_squares[friendly + 2][rook_to] ^ zobrist_table.pieces_and_squares[friendly + 2][rook_from];
+        pos.piece_on[rook_to] = NO_PIECE; pos.piece_on[rook_from] = friendly + 2;
+        bit_clear_opt(friendly_pieces, rook_to); bit_set_opt(friendly_pieces, rook_from);
     }
+    // update side to move
+    pos.white_to_move = (Us == WHITE);
+    pos.all_pieces = pos.white_pieces | pos.black_pieces;
+    // restore the irreversible info saved on the undo stack
+    pos.en_passant_target_square = state.en_passant_target_square;
+    pos.half_move_counter = state.half_move_counter;
+    pos.can_white_castle_kingside = state.can_white_castle_kingside;
+    pos.can_white_castle_queenside = state.can_white_castle_queenside;
+    pos.can_black_castle_kingside = state.can_black_castle_kingside;
+    pos.can_black_castle_queenside = state.can_black_castle_queenside;
+    // HASH: add back castling rights and en-passant file of the restored position
+    pos.hash ^= ZobristCastling(pos) ^ ZobristEnPassant(pos);
+    // debug check: the incremental key must match the full computation
+    assert(pos.hash == ZobristHashing(pos));
 }
 
-bool IsLegal(Position& pos, const Move& move){ 
+template void UnmakeMove<WHITE>(Position& pos, const MoveNew& move, UndoStack& undo);
+template void UnmakeMove<BLACK>(Position& pos, const MoveNew& move, UndoStack& undo);
+
+void UnmakeMove(Position& pos, const MoveNew& move, UndoStack& undo){
+    // the move was made by the side that is NOT to move now
+    pos.white_to_move ? UnmakeMove<BLACK>(pos, move, undo) : UnmakeMove<WHITE>(pos, move, undo);
+}
+
+template<Color Us>
+bool IsLegal(Position& pos, const Move& move){
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    constexpr uint8_t enemy = ColorTraits<Us>::enemy;
     uint64_t attacks;
     unsigned long king_square;
     uint8_t flags = (move >> 12);
-    // if white to move and black's king is in check, pos is illegal
-    if(pos.white_to_move){
-        // step 1: get black's king position
-        _BitScanForward64(&king_square, pos.pieces[6]);
-        // step 2: check attacks from white king
-        attacks = king_covered_squares_bitboards[king_square];
-        if(attacks & pos.pieces[0]){ return false; }
-        // step 3: check attacks from white knight
-        attacks = knight_covered_squares_bitboards[king_square];
-        if(attacks & pos.pieces[4]){ return false; }
-        // step 4: check attacks from white pawns
-        attacks = black_pawn_covered_squares_bitboards[king_square];
-        if(attacks & pos.pieces[5]){ return false; }
-        // step 5: check attacks from diagonal directions
-        uint64_t hash_index_bishop = bishop_hash_index(pos.all_pieces, king_square, n_attacks_bishop);
-        attacks = bishop_covered_squares_bitboards[hash_index_bishop];
-        if(attacks & (pos.pieces[1] | pos.pieces[3])){ return false; }
-        // step 6: check attacks from horizontal or vertical directions
-        uint64_t hash_index_rook = rook_hash_index(pos.all_pieces, king_square, n_attacks_rook);
-        attacks = rook_covered_squares_bitboards[hash_index_rook]; 
-        if(attacks & (pos.pieces[1] | pos.pieces[2])){ return false; }
-        // ...        
-        // if black just castled (so now is white to move), control that the black king was not passing through a square covered by white
-        if(flags == 2){
-            pos.white_covered_squares = GetCoveredSquares(pos.pieces, pos.all_pieces, true);
-            if(pos.white_covered_squares & BLACK_KINGSIDE_CASTLE_MASK){
-                return false;
-            }
-            //if(pos.pieces[6] & pos.white_covered_squares){ return false; }
-            /*if(bit_get(pos.white_covered_squares, 4) ||
-                bit_get(pos.white_covered_squares, 5) ||
-                bit_get(pos.white_covered_squares, 6)){
-                    return false;
-            }*/
+    // Us just made the move: if our king is in check, pos is illegal
+    // step 1: get our king position
+    king_square = get_last_active_bit(pos.pieces[friendly]);
+    // step 2: check attacks from enemy king
+    attacks = king_covered_squares_bitboards[king_square];
+    if(attacks & pos.pieces[enemy]){ return false; }
+    // step 3: check attacks from enemy knight
+    attacks = knight_covered_squares_bitboards[king_square];
+    if(attacks & pos.pieces[enemy + 4]){ return false; }
+    // step 4: check attacks from enemy pawns (they attack our king from the squares that our pawn on the king square would attack)
+    attacks = pawn_covered_squares_table<Us>()[king_square];
+    if(attacks & pos.pieces[enemy + 5]){ return false; }
+    // step 5: check attacks from diagonal directions
+    attacks = bishop_attacks(pos.all_pieces, king_square);
+    if(attacks & (pos.pieces[enemy + 1] | pos.pieces[enemy + 3])){ return false; }
+    // step 6: check attacks from horizontal or vertical directions
+    attacks = rook_attacks(pos.all_pieces, king_square);
+    if(attacks & (pos.pieces[enemy + 1] | pos.pieces[enemy + 2])){ return false; }
+    // if we just castled, control that the king was not passing through a square covered by the opponent
+    if(flags == 2 || flags == 3){
+        const uint64_t enemy_covered_squares = CoveredSquares<~Us>(pos);
+        if(flags == 2 && (enemy_covered_squares & ((Us == WHITE) ? WHITE_KINGSIDE_CASTLE_MASK : BLACK_KINGSIDE_CASTLE_MASK))){
+            return false;
+        }
+        if(flags == 3 && (enemy_covered_squares & ((Us == WHITE) ? WHITE_QUEENSIDE_CASTLE_MASK : BLACK_QUEENSIDE_CASTLE_MASK))){
+            return false;
         }
-        else if(flags == 3){
-            pos.white_covered_squares = GetCoveredSquares(pos.pieces, pos.all_pieces, true);
-            if(pos.white_covered_squares & BLACK_QUEENSIDE_CASTLE_MASK){
-                return false;
-            }
-            //if(pos.pieces[6] & pos.white_covered_squares){ return false; }
-            /*if(bit_get(pos.white_covered_squares, 2) ||
-                bit_get(pos.white_covered_squares, 3) ||
-                bit_get(pos.white_covered_squares, 4)){
-                    return false;
-            }*/
-        }
-        // if all the previous legality checks are passed, return true
-        return true;
     }
-    // if black to move and white's king is in check, pos is illegal
+    // if all the previous legality checks are passed, return true
+    return true;
+}
+
+template bool IsLegal<WHITE>(Position& pos, const Move& move);
+template bool IsLegal<BLACK>(Position& pos, const Move& move);
+
+bool IsLegal(Position& pos, const Move& move){
+    // the move was made by the side that is NOT to move now
+    return pos.white_to_move ? IsLegal<BLACK>(pos, move) : IsLegal<WHITE>(pos, move);
+}
+
+template<Color Us>
+bool IsPseudoLegal(const Position& pos, const MoveNew& move){
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    constexpr int pawn_push = ColorTraits<Us>::pawn_push;
+    uint8_t from, to, flags, piece;
+    uint64_t attacks;
+    from = move & 0b00111111;
+    to = (move >> 6) & 0b00111111;
+    flags = (move >> 12);
+    const uint64_t enemy_pieces = PiecesOf<~Us>(pos);
+
+    // the moved piece must belong to the side to move, the target square cannot contain a friendly piece
+    piece = pos.piece_on[from];
+    if(piece < friendly || piece > friendly + 5){ return false; }
+    if(bit_get_opt(PiecesOf<Us>(pos), to)){ return false; }
+    if(flags == 6 || flags == 7){ return false; }
+    // a capture needs an enemy piece on the target square, any other move an empty square (en-passant is checked below)
+    bool is_capture = (flags == 4 || flags >= 12);
+    if(flags != 5 && is_capture != bit_get_opt(enemy_pieces, to)){ return false; }
+    // only pawns make double pushes, en-passant captures and promotions, only the king castles
+    if((flags == 1 || flags == 5 || flags >= 8) && piece != friendly + 5){ return false; }
+    if((flags == 2 || flags == 3) && piece != friendly){ return false; }
+
+    // -----------------
+    // ----- PAWNS -----
+    // -----------------
+    if(piece == friendly + 5){
+        // a pawn reaching the last rank must promote, and it can promote only there
+        if((to / 8 == ColorTraits<Us>::promotion_rank) != (flags >= 8)){ return false; }
+        if(flags == 0 || (flags >= 8 && flags <= 11)){ return to == from + pawn_push; }
+        if(flags == 1){
+            return from / 8 == ColorTraits<Us>::starting_rank && to == from + 2*pawn_push && !bit_get_opt(pos.all_pieces, from + pawn_push);
+        }
+        if(!bit_get_opt(pawn_covered_squares_table<Us>()[from], to)){ return false; }
+        return flags != 5 || bit_get_opt(pos.en_passant_target_square, to);
+    }
+    // --------------------
+    // ----- CASTLING -----
+    // --------------------
+    if(flags == 2 || flags == 3){
+        constexpr uint8_t king_home = ColorTraits<Us>::king_home;
+        const bool kingside = (flags == 2);
+        const uint8_t rook_home = kingside ? ColorTraits<Us>::kingside_rook_home : ColorTraits<Us>::queenside_rook_home;
+        const bool has_right = kingside ? CanCastleKingside<Us>(pos) : CanCastleQueenside<Us>(pos);
+        if(!has_right || from != king_home || to != (kingside ? king_home + 2 : king_home - 2)){ return false; }
+        if(!bit_get_opt(pos.pieces[friendly + 2], rook_home)){ return false; }
+        // squares between king and rook must be empty
+        return (pos.all_pieces & squares_between[king_home][rook_home]) == 0;
+    }
+    // -----------------------------------------
+    // ----- KING, QUEEN, ROOK, BISHOP, KNIGHT -
+    // -----------------------------------------
+    if(piece == friendly){ attacks = king_covered_squares_bitboards[from]; }
+    else if(piece == friendly + 4){ attacks = knight_covered_squares_bitboards[from]; }
     else{
-        // step 1: get black's king position
-        _BitScanForward64(&king_square, pos.pieces[0]);
-        // step 2: check attacks from white king
-        attacks = king_covered_squares_bitboards[king_square];
-        if(attacks & pos.pieces[6]){ return false; }
-        // step 3: check attacks from white knight
-        attacks = knight_covered_squares_bitboards[king_square];
-        if(attacks & pos.pieces[10]){ return false; }
-        // step 4: check attacks from white pawns
-        attacks = white_pawn_covered_squares_bitboards[king_square];
-        if(attacks & pos.pieces[11]){ return false; }
-        // step 5: check attacks from diagonal directions
-        uint64_t hash_index_bishop = bishop_hash_index(pos.all_pieces, king_square, n_attacks_bishop);
-        attacks = bishop_covered_squares_bitboards[hash_index_bishop];
-        if(attacks & (pos.pieces[7] | pos.pieces[9])){ return false; }
-        // step 6: check attacks from horizontal or vertical directions
-        uint64_t hash_index_rook = rook_hash_index(pos.all_pieces, king_square, n_attacks_rook);
-        attacks = rook_covered_squares_bitboards[hash_index_rook]; 
-        if(attacks & (pos.pieces[7] | pos.pieces[8])){ return false; }
-        if(flags == 2){
-            pos.black_covered_squares = GetCoveredSquares(pos.pieces, pos.all_pieces, false);
-            //if(pos.pieces[0] & pos.black_covered_squares){ return false; }
-            if(pos.black_covered_squares & WHITE_KINGSIDE_CASTLE_MASK){
-                return false;
-            }
-            /*if(bit_get(pos.black_covered_squares, 60) ||
-                bit_get(pos.black_covered_squares, 61) ||
-                bit_get(pos.black_covered_squares, 62)){
-                    return false;
-            }*/
-        }
-        else if(flags == 3){
-            pos.black_covered_squares = GetCoveredSquares(pos.pieces, pos.all_pieces, false);
-            if(pos.black_covered_squares & WHITE_QUEENSIDE_CASTLE_MASK){
-                return false;
-            }
-            //if(pos.pieces[0] & pos.black_covered_squares){ return false; }
-            /*if(bit_get(pos.black_covered_squares, 60) ||
-                bit_get(pos.black_covered_squares, 59) ||
-                bit_get(pos.black_covered_squares, 58)){
-                    return false;
-            }*/
-        }
-        return true;
+        attacks = 0ULL;
+        if(piece != friendly + 3){ attacks |= rook_attacks(pos.all_pieces, from); }
+        if(piece != friendly + 2){ attacks |= bishop_attacks(pos.all_pieces, from); }
     }
+    return bit_get_opt(attacks, to);
+}
+
+template bool IsPseudoLegal<WHITE>(const Position& pos, const MoveNew& move);
+template bool IsPseudoLegal<BLACK>(const Position& pos, const MoveNew& move);
+
+bool IsPseudoLegal(const Position& pos, const MoveNew& move){
+    return pos.white_to_move ? IsPseudoLegal<WHITE>(pos, move) : IsPseudoLegal<BLACK>(pos, move);
 }
 
 // FIND LIST OF LEGAL MOVES
+// Copy-make version: every legal move is applied to a copy of the position, which is stored with the move.
+// The moves are generated by LegalMovesNew and applied with MakeMove; here we only translate them
+// to the Move encoding (moved piece, captured piece, promotion, flags) used by ScoreMove and PrintMove
+template<Color Us>
 void LegalMoves(Position& pos, MoveAndPosition* all_moves){
-    size_t move_index = 0;
-    bool is_capture, is_illegal;
-    uint64_t is_check;
-    uint64_t piece, hash_index_rook, hash_index_bishop;
-    uint64_t attacks = 0ULL;
-    unsigned long square, target_square;
-    uint8_t flags = 0;
-    uint8_t piece_index, captured_piece_index;
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    constexpr uint8_t enemy = ColorTraits<Us>::enemy;
+    uint8_t from, to, flags, piece_index, captured_piece_index, promoted_piece_index, move_flags;
+    MoveNew moves[MAX_NUMBER_OF_MOVES];
+    // the children are copies: their undo information is never used
+    UndoStack undo;
     MoveAndPosition m;
     m.score = 0;
 
     if((pos.pieces[0] | pos.pieces[6]) == 0){
         pos.n_legal_moves = 0;
-        return; 
+        return;
     }
 
-    // WHITE TO MOVE
-    if(pos.white_to_move){
+    uint8_t n_moves = LegalMovesNew<Us>(pos, moves, ALL_MOVES);
+    // the check flag is computed without looking at the children
+    const CheckInfo check_info = ComputeCheckInfo<Us>(pos);
+    for(uint8_t move_index = 0; move_index < n_moves; move_index++){
+        from = moves[move_index] & 0b00111111;
+        to = (moves[move_index] >> 6) & 0b00111111;
+        flags = (moves[move_index] >> 12);
+        piece_index = pos.piece_on[from];
+        captured_piece_index = (flags == 5) ? enemy + 5 : pos.piece_on[to];
+        if(captured_piece_index == NO_PIECE){ captured_piece_index = 15; } // no capture
+        promoted_piece_index = (flags >= 8) ? friendly + 4 - (flags & 0b0011) : 15; // no promotion
+        // flags of the Move encoding: 1 = pawn move, 2 = double push, 4 = castling, 8 = capture, 16 = check
+        move_flags = 0;
+        if(piece_index == friendly + 5){ move_flags += 1; }
+        if(flags == 1){ move_flags += 2; }
+        if(flags == 2 || flags == 3){ move_flags += 4; }
+        if(captured_piece_index != 15){ move_flags += 8; }
+        // Generate new position applying the move
+        m.position = pos;
+        MakeMove<Us>(m.position, moves[move_index], undo);
+        undo.ply = 0;
+        if(GivesCheck<Us>(pos, check_info, moves[move_index])){ move_flags += 16; }
+        m.move = EncodeMove(from, to, piece_index, captured_piece_index, promoted_piece_index, move_flags);
+        all_moves[move_index] = m;
+    }
+    pos.n_legal_moves = n_moves;
+}
 
-        // King
-        piece_index = 0;
-        piece = pos.pieces[piece_index]; // retrieve bitboard of king
-        while(piece){ 
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            attacks = king_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.white_pieces; // exclude self-capture
-            while(attacks){
-                flags = 0;
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.black_pieces, target_square);
-                captured_piece_index = 15; // no capture (default)
-                // Generate new position applying the move
-                m.position = pos;
-                // move the piece in white pieces bitboards
-                bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                bit_clear(m.position.white_pieces, square); bit_set(m.position.white_pieces, target_square);
-                // if capture, also change bitboards of black pieces and recompute values
-                if(is_capture){
-                    flags += 8; // capture flag
-                    // check what black piece has been captured
-                    for(uint8_t index = 6; index < 12; index++){
-                        if(bit_get(pos.pieces[index], target_square)){
-                            captured_piece_index = index;
-                            break;
-                        }
-                    }
-                    //m.position.black_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    bit_clear(m.position.pieces[captured_piece_index], target_square);
-                    bit_clear(m.position.black_pieces, target_square);
-                }
-                else{ m.position.half_move_counter++; }
-                // compute all pieces bitboard and the covered squares
-                m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                // check if move is legal
-                is_illegal = m.position.pieces[0] & m.position.black_covered_squares;
-                if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                // castling rights are lost
-                m.position.can_white_castle_kingside = false;
-                m.position.can_white_castle_queenside = false;
-                // standard updates
-                m.position.white_to_move = false;
-                m.position.en_passant_target_square = 0ULL;
-                // check if the move is a check
-                is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                if(is_check){ flags += 16; }
-                // encode move if legal
-                m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                all_moves[move_index] = m;
-                move_index++;
-                // remove considered attack
-                clear_last_active_bit(attacks); 
-            }
-            // remove considered piece
-            clear_last_active_bit(piece);
+template void LegalMoves<WHITE>(Position& pos, MoveAndPosition* all_moves);
+template void LegalMoves<BLACK>(Position& pos, MoveAndPosition* all_moves);
+
+void LegalMoves(Position& pos, MoveAndPosition* all_moves){
+    pos.white_to_move ? LegalMoves<WHITE>(pos, all_moves) : LegalMoves<BLACK>(pos, all_moves);
+}
+
+// FIND LIST OF LEGAL MOVES WITHOUT COPYING THE POSITION
+// attackers (of both colors) to a given square, for a given occupancy of the board
+uint64_t AttackersTo(const Position& pos, unsigned long square, uint64_t occupancy){
+    uint64_t attacks_rook = rook_attacks(occupancy, square);
+    uint64_t attacks_bishop = bishop_attacks(occupancy, square);
+    return (king_covered_squares_bitboards[square] & (pos.pieces[0] | pos.pieces[6])) |
+           (knight_covered_squares_bitboards[square] & (pos.pieces[4] | pos.pieces[10])) |
+           // a white pawn attacks the square if a black pawn on the square would attack the white pawn, and vice versa
+           (black_pawn_covered_squares_bitboards[square] & pos.pieces[5]) |
+           (white_pawn_covered_squares_bitboards[square] & pos.pieces[11]) |
+           (attacks_rook & (pos.pieces[1] | pos.pieces[2] | pos.pieces[7] | pos.pieces[8])) |
+           (attacks_bishop & (pos.pieces[1] | pos.pieces[3] | pos.pieces[7] | pos.pieces[9]));
+}
+
+// the least valuable piece of a side (friendly = 0 if white, 6 if black) among the attackers: its square goes in 'from_set'
+// and the piece is returned, or NO_PIECE if the side has no attackers left
+static uint8_t LeastValuableAttacker(const Position& pos, uint64_t attackers, uint8_t friendly, uint64_t& from_set){
+    // pawn, knight, bishop, rook, queen, king
+    static const uint8_t order[6] = {5, 4, 3, 2, 1, 0};
+    for(uint8_t piece : order){
+        uint64_t subset = attackers & pos.pieces[friendly + piece];
+        if(subset){
+            from_set = subset & (~subset + 1);
+            return friendly + piece;
         }
+    }
+    from_set = 0ULL;
+    return NO_PIECE;
+}
 
-        // Queen
-        piece_index = 1;
-        piece = pos.pieces[piece_index]; // retrieve bitboard of queens
-        while(piece){ // consider all the queens
-            _BitScanForward64(&square, piece); // find position of queen and assign it to square
-            // retrieve bitboard of queen moves
-            hash_index_rook = rook_hash_index(pos.all_pieces, square, n_attacks_rook);
-            hash_index_bishop = bishop_hash_index(pos.all_pieces, square, n_attacks_bishop);
-            attacks = rook_covered_squares_bitboards[hash_index_rook] | bishop_covered_squares_bitboards[hash_index_bishop];
-            attacks &= ~pos.white_pieces; // excluse self-capture
-            // loop over all the attacks
-            while(attacks){
-                flags = 0;
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.black_pieces, target_square);
-                captured_piece_index = 15; // no capture 
-                // Generate new position applying the move
-                m.position = pos;
-                // move the piece in white pieces bitboards
-                bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                bit_clear(m.position.white_pieces, square); bit_set(m.position.white_pieces, target_square);
-                // if capture, also change bitboards of black pieces and recompute values
-                if(is_capture){
-                    flags += 8; // capture flag
-                    // check what black piece has been captured
-                    for(uint8_t index = 6; index < 12; index++){
-                        if(bit_get(pos.pieces[index], target_square)){
-                            captured_piece_index = index;
-                            break;
-                        }
-                    }
-                    //m.position.black_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    bit_clear(m.position.pieces[captured_piece_index], target_square);
-                    bit_clear(m.position.black_pieces, target_square);
-                }
-                else{ m.position.half_move_counter++; }
-                // compute all pieces bitboard and the covered squares
-                m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                // check if move is legal
-                is_illegal = m.position.pieces[0] & m.position.black_covered_squares;
-                if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                // standard updates
-                m.position.white_to_move = false;
-                m.position.en_passant_target_square = 0ULL;
-                // check if the move is a check
-                is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                if(is_check){ flags += 16; }
-                // encode move 
-                m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                all_moves[move_index] = m;
+int StaticExchangeEvaluation(const Position& pos, const MoveNew& move){
+    uint8_t from, to, flags, piece;
+    int gain[32], depth = 0;
+    from = move & 0b00111111;
+    to = (move >> 6) & 0b00111111;
+    flags = (move >> 12);
+
+    const uint64_t rooks_and_queens = pos.pieces[1] | pos.pieces[2] | pos.pieces[7] | pos.pieces[8];
+    const uint64_t bishops_and_queens = pos.pieces[1] | pos.pieces[3] | pos.pieces[7] | pos.pieces[9];
+    // only a piece moving along a line can uncover a slider behind it (a knight or a king can't be in the way)
+    const uint64_t may_xray = rooks_and_queens | bishops_and_queens | pos.pieces[5] | pos.pieces[11];
+    uint64_t occupancy = pos.all_pieces;
+    uint64_t from_set = 1ULL << from;
+    uint8_t friendly = pos.white_to_move ? 0 : 6;
+
+    piece = pos.piece_on[from];
+    gain[0] = 0;
+    if(flags == 5){
+        // the captured pawn is behind the target square: it leaves the board now, it doesn't block anything
+        gain[0] = abs(PIECES_VALUES[5]);
+        occupancy ^= 1ULL << (pos.white_to_move ? to + 8 : to - 8);
+    }
+    else if(pos.piece_on[to] != NO_PIECE){
+        gain[0] = abs(PIECES_VALUES[pos.piece_on[to]]);
+    }
+    // promoted piece: 11 = Q, 10 = R, 9 = B, 8 = N (+4 if capture) --> index 1, 2, 3, 4 in PIECES_VALUES.
+    // The new piece stands on the target square, so it is what the opponent captures next
+    int piece_value = abs(PIECES_VALUES[piece]);
+    if(flags >= 8){
+        piece_value = abs(PIECES_VALUES[4 - (flags & 0b0011)]);
+        gain[0] += piece_value - abs(PIECES_VALUES[5]);
+    }
+
+    uint64_t attackers = AttackersTo(pos, to, occupancy) & occupancy;
+    do{
+        depth++;
+        friendly = 6 - friendly;
+        // score if the piece on the target square is captured, assuming that the exchange stops there
+        gain[depth] = piece_value - gain[depth - 1];
+        // if both stopping and continuing lose for the side to capture, the result can't change anymore
+        if(std::max(-gain[depth - 1], gain[depth]) < 0){ break; }
+        // the last capturing piece leaves its square: add the sliders that were behind it (x-rays)
+        attackers ^= from_set;
+        occupancy ^= from_set;
+        if(from_set & may_xray){
+            attackers |= (rook_attacks(occupancy, to) & rooks_and_queens) | (bishop_attacks(occupancy, to) & bishops_and_queens);
+            attackers &= occupancy;
+        }
+        piece = LeastValuableAttacker(pos, attackers, friendly, from_set);
+        if(piece != NO_PIECE){ piece_value = abs(PIECES_VALUES[piece]); }
+    } while(from_set);
+    // go back from the end of the sequence: at every capture the side to move can also decide to stop
+    while(--depth){
+        gain[depth - 1] = -std::max(-gain[depth - 1], gain[depth]);
+    }
+    return gain[0];
+}
+
+template<Color Us>
+CheckInfo ComputeCheckInfo(const Position& pos){
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    constexpr uint8_t enemy = ColorTraits<Us>::enemy;
+    CheckInfo info;
+    unsigned long square;
+    uint64_t snipers, blockers;
+    const unsigned long king_square = get_last_active_bit(pos.pieces[enemy]);
+    info.enemy_king_square = king_square;
+
+    // our pawn attacks the king if an enemy pawn on the king square would attack our pawn
+    const uint64_t* pawn_covered_squares_bitboards = (Us == WHITE) ? black_pawn_covered_squares_bitboards.data() : white_pawn_covered_squares_bitboards.data();
+    const uint64_t attacks_rook = rook_attacks(pos.all_pieces, king_square);
+    const uint64_t attacks_bishop = bishop_attacks(pos.all_pieces, king_square);
+    info.check_squares[0] = 0ULL; // a king never gives check
+    info.check_squares[1] = attacks_rook | attacks_bishop;
+    info.check_squares[2] = attacks_rook;
+    info.check_squares[3] = attacks_bishop;
+    info.check_squares[4] = knight_covered_squares_bitboards[king_square];
+    info.check_squares[5] = pawn_covered_squares_bitboards[king_square];
+
+    // DISCOVERED CHECK CANDIDATES: as for the pinned pieces in LegalMovesNew, but with our sliders looking at the enemy king
+    info.discovered_check_candidates = 0ULL;
+    snipers = (rook_rays_bitboards[king_square] & (pos.pieces[friendly + 1] | pos.pieces[friendly + 2])) |
+              (bishop_rays_bitboards[king_square] & (pos.pieces[friendly + 1] | pos.pieces[friendly + 3]));
+    while(snipers){
+        square = get_last_active_bit(snipers);
+        blockers = squares_between[king_square][square] & pos.all_pieces;
+        // exactly one piece in between: if it is ours, moving it away uncovers the slider
+        if(blockers && (blockers & (blockers - 1)) == 0){
+            info.discovered_check_candidates |= blockers & PiecesOf<Us>(pos);
+        }
+        clear_last_active_bit(snipers);
+    }
+    return info;
+}
+
+template CheckInfo ComputeCheckInfo<WHITE>(const Position& pos);
+template CheckInfo ComputeCheckInfo<BLACK>(const Position& pos);
+
+CheckInfo ComputeCheckInfo(const Position& pos){
+    return pos.white_to_move ? ComputeCheckInfo<WHITE>(pos) : ComputeCheckInfo<BLACK>(pos);
+}
+
+template<Color Us>
+bool GivesCheck(const Position& pos, const CheckInfo& info, const MoveNew& move){
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    uint8_t from, to, flags;
+    uint64_t occupancy;
+    from = move & 0b00111111;
+    to = (move >> 6) & 0b00111111;
+    flags = (move >> 12);
+    const unsigned long king_square = info.enemy_king_square;
+
+    // DIRECT CHECK (promotions below: the new piece is not a pawn)
+    if(flags < 8 && bit_get_opt(info.check_squares[pos.piece_on[from] - friendly], to)){ return true; }
+    // DISCOVERED CHECK: the piece leaves the line between our slider and the king
+    if(bit_get_opt(info.discovered_check_candidates, from) && !bit_get_opt(line_through[king_square][from], to)){ return true; }
+    if(flags < 5 && flags != 2 && flags != 3){ return false; }
+
+    // the rare moves: look up the attacks on the board after the move
+    occupancy = (pos.all_pieces ^ (1ULL << from)) | (1ULL << to);
+    // CASTLING: only the rook can give check
+    if(flags == 2 || flags == 3){
+        const bool kingside = (flags == 2);
+        const uint8_t rook_from = kingside ? ColorTraits<Us>::kingside_rook_home : ColorTraits<Us>::queenside_rook_home;
+        const uint8_t rook_to = kingside ? to - 1 : to + 1;
+        occupancy = (occupancy ^ (1ULL << rook_from)) | (1ULL << rook_to);
+        return bit_get_opt(rook_attacks(occupancy, rook_to), king_square);
+    }
+    // EN-PASSANT: the captured pawn leaves the board too, and it can uncover one of our sliders
+    if(flags == 5){
+        occupancy ^= 1ULL << (to - ColorTraits<Us>::pawn_push);
+        return ((rook_attacks(occupancy, king_square) & (pos.pieces[friendly + 1] | pos.pieces[friendly + 2])) |
+                (bishop_attacks(occupancy, king_square) & (pos.pieces[friendly + 1] | pos.pieces[friendly + 3]))) != 0;
+    }
+    // PROMOTION: 11 = Q, 10 = R, 9 = B, 8 = N (+4 if capture). The pawn has left its square, which can be on the line to the king
+    switch(flags & 0b0011){
+        case 3: return bit_get_opt(rook_attacks(occupancy, to) | bishop_attacks(occupancy, to), king_square);
+        case 2: return bit_get_opt(rook_attacks(occupancy, to), king_square);
+        case 1: return bit_get_opt(bishop_attacks(occupancy, to), king_square);
+        default: return bit_get_opt(knight_covered_squares_bitboards[to], king_square);
+    }
+}
+
+template bool GivesCheck<WHITE>(const Position& pos, const CheckInfo& info, const MoveNew& move);
+template bool GivesCheck<BLACK>(const Position& pos, const CheckInfo& info, const MoveNew& move);
+
+bool GivesCheck(const Position& pos, const CheckInfo& info, const MoveNew& move){
+    return pos.white_to_move ? GivesCheck<WHITE>(pos, info, move) : GivesCheck<BLACK>(pos, info, move);
+}
+
+// Check evasions: the side to move is in check by the pieces in 'checkers'.
+// Instead of generating all the moves and discarding those that don't solve the check, only three kinds of moves are considered:
+//  1. king moves to squares not attacked by the opponent
+//  2. captures of the checker (only with a single checker)
+//  3. interpositions on the squares between the king and a checking slider (only with a single checker)
+// A pinned piece can never solve a check (moving along the pin it stays off the checking line), so it is ignored.
+// No full GetCoveredSquares is needed: the attacks are only looked up from the few squares involved.
+template<Color Us>
+static uint8_t GenerateEvasions(const Position& pos, MoveNew* moves, GenType type, unsigned long king_square, uint64_t checkers){
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    constexpr uint8_t enemy = ColorTraits<Us>::enemy;
+    constexpr int pawn_push = ColorTraits<Us>::pawn_push;
+    constexpr int promotion_rank = ColorTraits<Us>::promotion_rank;
+    // rank reached by a double push
+    constexpr int double_push_rank = ColorTraits<Us>::double_push_rank;
+    uint8_t move_index = 0;
+    uint64_t attacks, evaders, snipers, blockers, between, pinned = 0ULL;
+    unsigned long square, target_square, checker_square;
+
+    const uint64_t friendly_pieces = PiecesOf<Us>(pos);
+    const uint64_t enemy_pieces = PiecesOf<~Us>(pos);
+    const uint64_t enemy_rooks_and_queens = pos.pieces[enemy + 1] | pos.pieces[enemy + 2];
+    const uint64_t enemy_bishops_and_queens = pos.pieces[enemy + 1] | pos.pieces[enemy + 3];
+
+    // -----------------------
+    // ----- KING MOVES ------
+    // -----------------------
+    // the king is removed from the occupancy, so that it cannot step back along the ray of a checking slider
+    uint64_t occupancy_without_king = pos.all_pieces & ~pos.pieces[friendly];
+    attacks = king_covered_squares_bitboards[king_square] & ~friendly_pieces;
+    if(type == CAPTURES){ attacks &= enemy_pieces; }
+    else if(type == QUIETS){ attacks &= ~enemy_pieces; }
+    while(attacks){
+        target_square = get_last_active_bit(attacks);
+        if((AttackersTo(pos, target_square, occupancy_without_king) & enemy_pieces) == 0){
+            moves[move_index] = EncodeMoveNew(king_square, target_square, bit_get(enemy_pieces, target_square) ? 4 : 0);
+            move_index++;
+        }
+        clear_last_active_bit(attacks);
+    }
+
+    // in double check only the king can move
+    if(checkers & (checkers - 1)){ return move_index; }
+    checker_square = get_last_active_bit(checkers);
+
+    // pinned pieces (see LegalMovesNew)
+    snipers = (rook_attacks(enemy_pieces, king_square) & enemy_rooks_and_queens) |
+              (bishop_attacks(enemy_pieces, king_square) & enemy_bishops_and_queens);
+    while(snipers){
+        square = get_last_active_bit(snipers);
+        blockers = squares_between[king_square][square] & pos.all_pieces;
+        if(blockers && (blockers & (blockers - 1)) == 0){
+            pinned |= blockers & friendly_pieces;
+        }
+        clear_last_active_bit(snipers);
+    }
+    // pieces that can take part in the evasion: not the king (already done) and not pinned
+    const uint64_t free_pieces = friendly_pieces & ~pos.pieces[friendly] & ~pinned;
+
+    // ----------------------------------
+    // ----- CAPTURE OF THE CHECKER -----
+    // ----------------------------------
+    if(type != QUIETS){
+        evaders = AttackersTo(pos, checker_square, pos.all_pieces) & free_pieces;
+        while(evaders){
+            square = get_last_active_bit(evaders);
+            if(bit_get(pos.pieces[friendly + 5], square)){
+                AddPawnMove(moves, move_index, square, checker_square, 4, promotion_rank);
+            }
+            else{
+                moves[move_index] = EncodeMoveNew(square, checker_square, 4);
                 move_index++;
-                // remove considered attack
-                clear_last_active_bit(attacks); 
             }
-            // remove considered piece
-            clear_last_active_bit(piece);
-        }
-
-        // Rook
-        piece_index = 2;
-        piece = pos.pieces[piece_index];
-        while(piece){ // consider all the queens
-            _BitScanForward64(&square, piece); // find position of rook and assign it to square
-            // retrieve bitboard of rook moves
-            hash_index_rook = rook_hash_index(pos.all_pieces, square, n_attacks_rook);
-            attacks = rook_covered_squares_bitboards[hash_index_rook];
-            attacks &= ~pos.white_pieces; // excluse self-capture
-            // loop over all the attacks
-            while(attacks){
-                flags = 0;
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.black_pieces, target_square);
-                captured_piece_index = 15; // no capture 
-                // Generate new position applying the move
-                m.position = pos;
-                // move the piece in white pieces bitboards
-                bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                bit_clear(m.position.white_pieces, square); bit_set(m.position.white_pieces, target_square);
-                // if capture, also change bitboards of black pieces and recompute values
-                if(is_capture){
-                    flags += 8; // capture flag
-                    // check what black piece has been captured
-                    for(uint8_t index = 6; index < 12; index++){
-                        if(bit_get(pos.pieces[index], target_square)){
-                            captured_piece_index = index;
-                            break;
-                        }
+            clear_last_active_bit(evaders);
+        }
+        // en-passant: the checker is the pawn that has just made a double push, or the pawn lands on the checking ray
+        if(pos.en_passant_target_square){
+            target_square = get_last_active_bit(pos.en_passant_target_square);
+            unsigned long captured_square = target_square - pawn_push;
+            if(captured_square == checker_square || bit_get(squares_between[king_square][checker_square], target_square)){
+                // friendly pawns attacking the target square (seen from the target square with the opponent's pawn table)
+                evaders = pawn_covered_squares_table<~Us>()[target_square] &
+                          pos.pieces[friendly + 5] & ~pinned;
+                while(evaders){
+                    square = get_last_active_bit(evaders);
+                    // two pawns leave the board at once: check the horizontal exposure of the king directly
+                    uint64_t occupancy = (pos.all_pieces & ~(1ULL << square) & ~(1ULL << captured_square)) | pos.en_passant_target_square;
+                    bool is_exposed = (rook_attacks(occupancy, king_square) & enemy_rooks_and_queens) ||
+                                      (bishop_attacks(occupancy, king_square) & enemy_bishops_and_queens);
+                    if(!is_exposed){
+                        moves[move_index] = EncodeMoveNew(square, target_square, 5);
+                        move_index++;
                     }
-                    //m.position.black_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    bit_clear(m.position.pieces[captured_piece_index], target_square);
-                    bit_clear(m.position.black_pieces, target_square);
+                    clear_last_active_bit(evaders);
                 }
-                else{ m.position.half_move_counter++; }
-                // compute all pieces bitboard and the covered squares
-                m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                // check if move is legal
-                is_illegal = m.position.pieces[0] & m.position.black_covered_squares;
-                if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                // castling rights are lost
-                if(square == 63) { m.position.can_white_castle_kingside = false; }
-                else if(square == 56) { m.position.can_white_castle_queenside = false; }
-                // standard updates
-                m.position.white_to_move = false;
-                m.position.en_passant_target_square = 0ULL;
-                // check if the move is a check
-                is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                if(is_check){ flags += 16; }
-                // encode move 
-                m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                all_moves[move_index] = m;
-                move_index++;
-                // remove considered attack
-                clear_last_active_bit(attacks); 
             }
-            // remove considered piece
-            clear_last_active_bit(piece);
         }
+    }
 
-        // Bishop
-        piece_index = 3;
-        piece = pos.pieces[piece_index]; // retrieve bitboard of bishops
-        while(piece){ // consider all the bishops
-            _BitScanForward64(&square, piece); // find position of queen and assign it to square
-            // retrieve bitboard of bishop moves
-            hash_index_bishop = bishop_hash_index(pos.all_pieces, square, n_attacks_bishop);
-            attacks = bishop_covered_squares_bitboards[hash_index_bishop];
-            attacks &= ~pos.white_pieces; // excluse self-capture
-            // loop over all the attacks
-            while(attacks){
-                flags = 0;
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.black_pieces, target_square);
-                captured_piece_index = 15; // no capture 
-                // Generate new position applying the move
-                m.position = pos;
-                // move the piece in white pieces bitboards
-                bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                bit_clear(m.position.white_pieces, square); bit_set(m.position.white_pieces, target_square);
-                // if capture, also change bitboards of black pieces and recompute values
-                if(is_capture){
-                    flags += 8; // capture flag
-                    // check what black piece has been captured
-                    for(uint8_t index = 6; index < 12; index++){
-                        if(bit_get(pos.pieces[index], target_square)){
-                            captured_piece_index = index;
-                            break;
-                        }
-                    }
-                    //m.position.black_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    bit_clear(m.position.pieces[captured_piece_index], target_square);
-                    bit_clear(m.position.black_pieces, target_square);
-                }
-                else{ m.position.half_move_counter++; }
-                // compute all pieces bitboard and the covered squares
-                m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                // check if move is legal
-                is_illegal = m.position.pieces[0] & m.position.black_covered_squares;
-                if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                // standard updates
-                m.position.white_to_move = false;
-                m.position.en_passant_target_square = 0ULL;
-                // check if the move is a check
-                is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                if(is_check){ flags += 16; }
-                // encode move 
-                m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                all_moves[move_index] = m;
+    // ------------------------
+    // ----- INTERPOSITION ----
+    // ------------------------
+    // only possible if the checker is a slider not adjacent to the king (otherwise there are no squares in between)
+    between = squares_between[king_square][checker_square];
+    while(between){
+        target_square = get_last_active_bit(between);
+        // a block is a quiet move, unless a pawn promotes on the blocking square
+        bool is_promotion = (target_square / 8 == promotion_rank);
+        if(type != CAPTURES){
+            evaders = AttackersTo(pos, target_square, pos.all_pieces) & free_pieces & ~pos.pieces[friendly + 5];
+            while(evaders){
+                square = get_last_active_bit(evaders);
+                moves[move_index] = EncodeMoveNew(square, target_square, 0);
                 move_index++;
-                // remove considered attack
-                clear_last_active_bit(attacks); 
+                clear_last_active_bit(evaders);
             }
-            // remove considered piece
-            clear_last_active_bit(piece);
         }
-
-        // Knight
-        piece_index = 4;
-        piece = pos.pieces[piece_index]; // retrieve bitboard of knights
-        while(piece){ // consider all the knights
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            attacks = knight_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.white_pieces; // exclude self-capture
-            while(attacks){
-                flags = 0;
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.black_pieces, target_square);
-                captured_piece_index = 15; // no capture 
-                // Generate new position applying the move
-                m.position = pos;
-                // move the piece in white pieces bitboards
-                bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                bit_clear(m.position.white_pieces, square); bit_set(m.position.white_pieces, target_square);
-                // if capture, also change bitboards of black pieces and recompute values
-                if(is_capture){
-                    flags += 8; // capture flag
-                    // check what black piece has been captured
-                    for(uint8_t index = 6; index < 12; index++){
-                        if(bit_get(pos.pieces[index], target_square)){
-                            captured_piece_index = index;
-                            break;
-                        }
-                    }
-                    //m.position.black_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    bit_clear(m.position.pieces[captured_piece_index], target_square);
-                    bit_clear(m.position.black_pieces, target_square);
-                }
-                else{ m.position.half_move_counter++; }
-                // compute all pieces bitboard and the covered squares
-                m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                // check if move is legal
-                is_illegal = m.position.pieces[0] & m.position.black_covered_squares;
-                if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                // standard updates
-                m.position.white_to_move = !pos.white_to_move;
-                m.position.en_passant_target_square = 0ULL;
-                // check if the move is a check
-                is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                if(is_check){ flags += 16; }
-                // encode move 
-                m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                all_moves[move_index] = m;
+        if(type == ALL_MOVES || (type == CAPTURES) == is_promotion){
+            // single push of a pawn behind the square
+            square = target_square - pawn_push;
+            if(bit_get(pos.pieces[friendly + 5] & free_pieces, square)){
+                AddPawnMove(moves, move_index, square, target_square, 0, promotion_rank);
+            }
+            // double push: the square in between must be empty
+            else if(target_square / 8 == double_push_rank && !bit_get(pos.all_pieces, square) &&
+                    bit_get(pos.pieces[friendly + 5] & free_pieces, square - pawn_push)){
+                moves[move_index] = EncodeMoveNew(square - pawn_push, target_square, 1);
                 move_index++;
-                clear_last_active_bit(attacks); // remove considered attack
             }
-            // remove considered piece
-            clear_last_active_bit(piece);
         }
+        clear_last_active_bit(between);
+    }
+
+    return move_index;
+}
+
+template<Color Us>
+uint8_t LegalMovesNew(const Position& pos, MoveNew* moves, GenType type){
+    uint8_t move_index = 0;
+    uint64_t piece, attacks, attacks_rook, attacks_bishop;
+    unsigned long square, target_square, king_square;
+    uint16_t flags;
+
+    // indexes of the pieces of the side to move (friendly) and of the opponent (enemy) in pos.pieces:
+    // K = friendly + 0, Q = friendly + 1, R = friendly + 2, B = friendly + 3, N = friendly + 4, P = friendly + 5
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    constexpr uint8_t enemy = ColorTraits<Us>::enemy;
+    // pawns move towards lower squares if white and towards higher squares if black
+    constexpr int pawn_push = ColorTraits<Us>::pawn_push;
+    constexpr int promotion_rank = ColorTraits<Us>::promotion_rank;
+    constexpr uint8_t king_home = ColorTraits<Us>::king_home;
+    const uint64_t friendly_pieces = PiecesOf<Us>(pos);
+    const uint64_t enemy_pieces = PiecesOf<~Us>(pos);
+    const uint64_t enemy_rooks_and_queens = pos.pieces[enemy + 1] | pos.pieces[enemy + 2];
+    const uint64_t enemy_bishops_and_queens = pos.pieces[enemy + 1] | pos.pieces[enemy + 3];
+    // squares attacked by a friendly pawn in a given square
+    const uint64_t* pawn_covered_squares_bitboards = pawn_covered_squares_table<Us>();
+    // squares where the moves of the requested type can land: enemy pieces for captures, empty squares for quiet moves
+    const uint64_t type_mask = (type == CAPTURES) ? enemy_pieces : (type == QUIETS) ? ~pos.all_pieces : ~friendly_pieces;
+    // pawn moves also depend on the promotion rank: promotions (even without capture) belong to the captures
+    uint64_t pawn_type_mask = ~friendly_pieces;
+    if(type == CAPTURES){ pawn_type_mask = enemy_pieces | ranks_bitboards[promotion_rank]; }
+    else if(type == QUIETS){ pawn_type_mask = ~pos.all_pieces & ~ranks_bitboards[promotion_rank]; }
+
+    if(pos.pieces[friendly] == 0){ return 0; }
+    king_square = get_last_active_bit(pos.pieces[friendly]);
+
+    // -------------------------------------------------
+    // ----- PER-NODE INFO: CHECKERS, PINS, DANGER -----
+    // -------------------------------------------------
+    // CHECKERS: enemy pieces attacking the king (same logic as IsLegal, looking from the king square)
+    attacks_rook = rook_attacks(pos.all_pieces, king_square);
+    attacks_bishop = bishop_attacks(pos.all_pieces, king_square);
+    uint64_t checkers = (knight_covered_squares_bitboards[king_square] & pos.pieces[enemy + 4]) |
+                        (pawn_covered_squares_bitboards[king_square] & pos.pieces[enemy + 5]) |
+                        (attacks_rook & enemy_rooks_and_queens) |
+                        (attacks_bishop & enemy_bishops_and_queens);
+    // in check: only the evasions are generated
+    if(checkers){ return GenerateEvasions<Us>(pos, moves, type, king_square, checkers); }
 
-        // Pawns 
-        piece_index = 5;
+    // PINNED PIECES: look from the king square as if only enemy pieces were on the board.
+    // Every enemy slider seen like this (sniper) pins a friendly piece if it is the only piece in between
+    uint64_t pinned = 0ULL, snipers, blockers;
+    attacks_rook = rook_attacks(enemy_pieces, king_square);
+    attacks_bishop = bishop_attacks(enemy_pieces, king_square);
+    snipers = (attacks_rook & enemy_rooks_and_queens) |
+              (attacks_bishop & enemy_bishops_and_queens);
+    while(snipers){
+        square = get_last_active_bit(snipers);
+        blockers = squares_between[king_square][square] & pos.all_pieces;
+        // exactly one piece in between: if it is friendly, it is pinned
+        if(blockers && (blockers & (blockers - 1)) == 0){
+            pinned |= blockers & friendly_pieces;
+        }
+        clear_last_active_bit(snipers);
+    }
+
+    // DANGER: squares covered by the opponent. They should be computed without our king on the board
+    // (so that the king cannot escape a slider check by stepping back along the checking ray), but we are not in check:
+    // no enemy slider sees our king, and the covered squares are the same with or without it
+    const uint64_t danger = CoveredSquares<~Us>(pos);
+
+    // -----------------
+    // ----- KING ------
+    // -----------------
+    attacks = king_covered_squares_bitboards[king_square] & type_mask & ~danger;
+    while(attacks){
+        target_square = get_last_active_bit(attacks);
+        flags = bit_get(enemy_pieces, target_square) ? 4 : 0;
+        moves[move_index] = EncodeMoveNew(king_square, target_square, flags);
+        move_index++;
+        clear_last_active_bit(attacks);
+    }
+
+    // TARGET: squares where the other pieces are allowed to land
+    uint64_t target = ~friendly_pieces;
+
+    // -----------------------------------
+    // ----- QUEEN, ROOK, BISHOP, KNIGHT -
+    // -----------------------------------
+    for(uint8_t piece_index = friendly + 1; piece_index < friendly + 5; piece_index++){
         piece = pos.pieces[piece_index];
         while(piece){
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            // NORMAL CAPTURES
-            attacks = white_pawn_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= pos.black_pieces | pos.en_passant_target_square; // only attacked squares occupied by enemy pieces are valid for movement
-            while(attacks){
-                flags = 1;
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = true; // this is necessarily a capture!
-                flags += 8; // capture flag
-                // check what black piece has been captured
-                for(int index = 6; index < 12; index++){
-                    if(bit_get(pos.pieces[index], target_square)){
-                        captured_piece_index = index;
-                        break;
-                    }
-                }
-                // in case of promotion, loop over all possible promoted pieces
-                if(target_square / 8 == 0){
-                    for(uint8_t promoted_piece_index = 1; promoted_piece_index < 5; promoted_piece_index++){
-                        // Generate new position applying the move
-                        m.position = pos;
-                        // move the piece in white pieces bitboards
-                        bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[promoted_piece_index], target_square);
-                        bit_clear(m.position.white_pieces, square); bit_set(m.position.white_pieces, target_square);
-                        //m.position.white_material_value += PIECES_VALUES[promoted_piece_index] - WHITE_PAWN_VALUE;
-                        //m.position.black_material_value -= PIECES_VALUES[captured_piece_index];
-                        m.position.half_move_counter = 0;
-                        bit_clear(m.position.pieces[captured_piece_index], target_square);
-                        bit_clear(m.position.black_pieces, target_square);                        
-                        // compute all pieces bitboard and the covered squares
-                        m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                        m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                        m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                        // check if move is legal
-                        is_illegal = m.position.pieces[0] & m.position.black_covered_squares;
-                        if(is_illegal){ continue; }
-                        // standard updates
-                        m.position.white_to_move = false;
-                        m.position.en_passant_target_square = 0ULL;
-                        // check if the move is a check
-                        is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                        if(is_check){ flags += 16; }
-                        // encode move
-                        m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, promoted_piece_index, flags);
-                        all_moves[move_index] = m;
-                        move_index++;
-                    }
-                }
-                else{
-                    // Generate new position applying the move
-                    m.position = pos;
-                    // move the piece in white pieces bitboards
-                    bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                    bit_clear(m.position.white_pieces, square); bit_set(m.position.white_pieces, target_square);
-                    // also change bitboards of black pieces and recompute values (this is always a capture)
-                    //m.position.black_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    if((pos.en_passant_target_square & (1ULL << target_square)) == 0){ // no en passant
-                        bit_clear(m.position.pieces[captured_piece_index], target_square);
-                        bit_clear(m.position.black_pieces, target_square);   
-                    } 
-                    else{ // en passant capture
-                        captured_piece_index = 11;
-                        target_square += 8;
-                        bit_clear(m.position.pieces[captured_piece_index], target_square);
-                        bit_clear(m.position.black_pieces, target_square);   
-                        target_square -= 8;
-                    }               
-                    // compute all pieces bitboard and the covered squares
-                    m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                    m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                    m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                    // check if move is legal
-                    is_illegal = m.position.pieces[0] & m.position.black_covered_squares;
-                    if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                    // standard updates
-                    m.position.white_to_move = false;
-                    m.position.en_passant_target_square = 0ULL;
-                    // check if the move is a check
-                    is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                    if(is_check){ flags += 16; }
-                    // encode move
-                    m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                    all_moves[move_index] = m;
-                    move_index++;
-                }
-                clear_last_active_bit(attacks); // remove considered attack
+            square = get_last_active_bit(piece);
+            // retrieve bitboard of the moves of the piece
+            if(piece_index == friendly + 4){
+                attacks = knight_covered_squares_bitboards[square];
             }
-
-            // PUSH
-            attacks = white_pawn_advance_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.all_pieces; // control that there are no blockers in front
-            // problem: so far, if a piece is in front of the pawn and the pawn is in the starting rank, it can still advance 2 squares!
-            // everything is ok if the attack bitboard looks like this (1-square push and 2-square push both possible)
-            // .............
-            // ... 0 1 0 ...
-            // ... 0 1 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // or like this (single push is possible, double push is not)
-            // .............
-            // ... 0 0 0 ...
-            // ... 0 1 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // but a bitboard like this is not acceptable (2-square push is possible, 1-square push is not):
-            // .............
-            // ... 0 1 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // ... 0 0 0 ...
-            // (of course the latter is an acceptable bitboard if the pawn starting square is in the 3rd rank)
-            if((square/8 == 6) && !bit_get(attacks, square - 8) && bit_get(attacks, square - 16)){
+            else{
                 attacks = 0ULL;
-            }
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = false; // this is necessarily NOT a capture!
-                // in case of promotion, loop over all possible promoted pieces
-                if(target_square / 8 == 0){
-                    for(uint8_t promoted_piece_index = 1; promoted_piece_index < 5; promoted_piece_index++){
-                        flags = 1;
-                        // Generate new position applying the move
-                        m.position = pos;
-                        // move the piece in white pieces bitboards
-                        bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[promoted_piece_index], target_square);
-                        bit_clear(m.position.white_pieces, square); bit_set(m.position.white_pieces, target_square);
-                        // spawn the new piece 
-                        //m.position.white_material_value += PIECES_VALUES[promoted_piece_index] - WHITE_PAWN_VALUE;
-                        // compute all pieces bitboard and the covered squares
-                        m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                        m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                        m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                        // check if move is legal
-                        is_illegal = m.position.pieces[0] & m.position.black_covered_squares;
-                        if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                        m.position.half_move_counter = 0;
-                        // standard updates
-                        m.position.white_to_move = false;
-                        m.position.en_passant_target_square = 0ULL;
-                        // check if the move is a check
-                        is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                        if(is_check){ flags += 16; }             
-                        // flag that this is a promotion ...
-                        m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, 15/*no capture*/, promoted_piece_index, flags);
-                        all_moves[move_index] = m;
-                        move_index++;
-                    }
+                if(piece_index != friendly + 3){ // queen or rook
+                    attacks |= rook_attacks(pos.all_pieces, square);
                 }
-                // if this is a double push, flag it to manage en-passant target squares later
-                else if(target_square / 8 == 4 && square / 8 == 6){
-                    flags = 1;
-                    // Generate new position applying the move
-                    m.position = pos;
-                    // move the piece in white pieces bitboards
-                    bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                    bit_clear(m.position.white_pieces, square); bit_set(m.position.white_pieces, target_square);
-                    // compute all pieces bitboard and the covered squares
-                    m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                    m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                    m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                    // check if move is legal
-                    is_illegal = m.position.pieces[0] & m.position.black_covered_squares;
-                    if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                    m.position.half_move_counter = 0;
-                    // standard updates
-                    m.position.white_to_move = false;
-                    m.position.en_passant_target_square = 0ULL;
-                    m.position.en_passant_target_square |= (1ULL << (target_square + 8));
-                    // check if the move is a check
-                    is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                    if(is_check){ flags += 16; }   
-                    flags += 2;
-                    m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, 15/*no capture*/, 15/*no promotion*/, flags);
-                    all_moves[move_index] = m;
-                    move_index++;
+                if(piece_index != friendly + 2){ // queen or bishop
+                    attacks |= bishop_attacks(pos.all_pieces, square);
                 }
-                else{
-                    flags = 1;
-                    // Generate new position applying the move
-                    m.position = pos;
-                    // move the piece in white pieces bitboards
-                    bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                    bit_clear(m.position.white_pieces, square); bit_set(m.position.white_pieces, target_square);
-                    // compute all pieces bitboard and the covered squares
-                    m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                    m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                    m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                    // check if move is legal
-                    is_illegal = m.position.pieces[0] & m.position.black_covered_squares;
-                    if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                    m.position.half_move_counter = 0;
-                    // standard updates
-                    m.position.white_to_move = false;
-                    m.position.en_passant_target_square = 0ULL;
-                    // check if the move is a check
-                    is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                    if(is_check){ flags += 16; }   
-                    // encode move if legal 
-                    m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, 15/*no capture*/, 15/*no promotion*/, flags);
-                    all_moves[move_index] = m;
-                    move_index++;
-                }
-                clear_last_active_bit(attacks); // remove considered attack
             }
-            // remove considered piece
-            clear_last_active_bit(piece);
-        }
-
-        // Castles kingside
-        // here I am nesting if statements, because if one of them fails there's no need to go ahead and check all the other conditions
-        // the conditions involving bit_get() require a few bitwise operations, which we can confortably skip in many positions
-        if(pos.can_white_castle_kingside){ // 1. you still have right to castle from game history
-            if(!bit_get(pos.all_pieces, 61) && 
-                !bit_get(pos.all_pieces, 62)){ // 2. the in-between squares are empty
-                if(!bit_get(pos.black_covered_squares, 60) &&
-                    !bit_get(pos.black_covered_squares, 61) &&
-                    !bit_get(pos.black_covered_squares, 62)){ // 3. king does not pass through a square covered by opponent
-                   if(bit_get(pos.pieces[0], 60) &&
-                        bit_get(pos.pieces[2], 63)){ // 4. king and rook are in the correct position
-                        flags = 4;
-                        // Generate new position applying the move
-                        m.position = pos;
-                        // move king and rook in white pieces bitboards
-                        m.position.pieces[0] &= ~(1ULL << 60);
-                        m.position.pieces[0] |= (1ULL << 62);
-                        m.position.pieces[2] &= ~(1ULL << 63);
-                        m.position.pieces[2] |= (1ULL << 61);
-                        m.position.white_pieces &= ~(1ULL << 60);
-                        m.position.white_pieces &= ~(1ULL << 63);
-                        m.position.white_pieces |= (1ULL << 61);
-                        m.position.white_pieces |= (1ULL << 62);
-                        // compute all pieces bitboard and the covered squares
-                        m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                        m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                        m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                        m.position.half_move_counter++;
-                        // standard updates
-                        m.position.white_to_move = false;
-                        m.position.can_white_castle_kingside = false;
-                        m.position.can_white_castle_queenside = false;
-                        m.position.en_passant_target_square = 0ULL;
-                        // check if the move is a check
-                        is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                        if(is_check){ flags += 16; }   
-                        // no need to check legality: the move is always legal within these conditions
-                        // encode move, conventionally considered as a king move from square = 60 to target_square = 62
-                        m.move = EncodeMove(60, 62, 0/*king*/, 15/*no capture*/, 15/*no promotion*/, flags); 
-                        all_moves[move_index] = m;
-                        move_index++;
-                   } 
-                }
-            }   
-        }
-        // Castles queenside
-        if(pos.can_white_castle_queenside){ 
-            if(!bit_get(pos.all_pieces, 59) && 
-                !bit_get(pos.all_pieces, 58) &&
-                !bit_get(pos.all_pieces, 57)){ 
-                if(!bit_get(pos.black_covered_squares, 60) &&
-                    !bit_get(pos.black_covered_squares, 59) &&
-                    !bit_get(pos.black_covered_squares, 58)){
-                   if(bit_get(pos.pieces[0], 60) &&
-                        bit_get(pos.pieces[2], 56)){ 
-                        flags = 4;
-                        // Generate new position applying the move
-                        m.position = pos;
-                        // move king and rook in white pieces bitboards
-                        m.position.pieces[0] &= ~(1ULL << 60); // bit clear (faster like this)
-                        m.position.pieces[0] |= (1ULL << 58);
-                        m.position.pieces[2] &= ~(1ULL << 56);
-                        m.position.pieces[2] |= (1ULL << 59); // bit set (faster like this)
-                        m.position.white_pieces &= ~(1ULL << 60);
-                        m.position.white_pieces &= ~(1ULL << 56);
-                        m.position.white_pieces |= (1ULL << 58);
-                        m.position.white_pieces |= (1ULL << 59);
-                        // compute all pieces bitboard and the covered squares
-                        m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                        m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                        m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                        m.position.half_move_counter++;
-                        // standard updates
-                        m.position.white_to_move = false;
-                        m.position.can_white_castle_kingside = false;
-                        m.position.can_white_castle_queenside = false;
-                        m.position.en_passant_target_square = 0ULL;
-                        // check if the move is a check
-                        is_check = m.position.pieces[6] & m.position.white_covered_squares;
-                        if(is_check){ flags += 16; }   
-                        m.move = EncodeMove(60, 58, 0/*king*/, 15/*no capture*/, 15/*no promotion*/, flags); 
-                        all_moves[move_index] = m;
-                        move_index++;
-                   } 
-                }
-            }   
-        }
-        
-    }
-    
-    // BLACK TO MOVE
-    else{
-
-        // King
-        piece_index = 6;
-        piece = pos.pieces[piece_index]; // retrieve bitboard of king
-        while(piece){ 
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            attacks = king_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.black_pieces; // exclude self-capture
+            attacks &= target & type_mask;
+            // a pinned piece can only move along the line through the king and itself
+            if(bit_get(pinned, square)){ attacks &= line_through[king_square][square]; }
             while(attacks){
-                flags = 0;
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.white_pieces, target_square);
-                captured_piece_index = 15; // no capture 
-                // generate new position
-                m.position = pos;
-                // move the piece in black pieces bitboards
-                bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                bit_clear(m.position.black_pieces, square); bit_set(m.position.black_pieces, target_square);
-                // if capture, also change bitboards of white pieces and recompute values
-                if(is_capture){
-                    flags += 8; // capture flag
-                    // check what black piece has been captured
-                    for(uint8_t index = 0; index < 6; index++){
-                        if(bit_get(pos.pieces[index], target_square)){
-                            captured_piece_index = index;
-                            break;
-                        }
-                    }
-                    //m.position.white_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    bit_clear(m.position.pieces[captured_piece_index], target_square);
-                    bit_clear(m.position.white_pieces, target_square);
-                }
-                else{ m.position.half_move_counter++; }
-                // compute all pieces bitboard and the covered squares
-                m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                // check if move is legal
-                is_illegal = m.position.pieces[6] & m.position.white_covered_squares;
-                if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                // castling rights are lost
-                m.position.can_black_castle_kingside = false;
-                m.position.can_black_castle_queenside = false;
-                // standard updates
-                m.position.white_to_move = true;
-                m.position.en_passant_target_square = 0ULL;
-                // check if the move is a check
-                is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                if(is_check){ flags += 16; }
-                // encode move 
-                m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                all_moves[move_index] = m;
+                target_square = get_last_active_bit(attacks);
+                flags = bit_get(enemy_pieces, target_square) ? 4 : 0;
+                moves[move_index] = EncodeMoveNew(square, target_square, flags);
                 move_index++;
-                clear_last_active_bit(attacks); // remove considered attack
+                clear_last_active_bit(attacks);
             }
-            // remove considered piece
             clear_last_active_bit(piece);
         }
+    }
 
-        // Queen
-        piece_index = 7;
-        piece = pos.pieces[piece_index]; // retrieve bitboard of queens
-        while(piece){ // consider all the queens
-            _BitScanForward64(&square, piece); // find position of queen and assign it to square
-            // retrieve bitboard of queen moves
-            hash_index_rook = rook_hash_index(pos.all_pieces, square, n_attacks_rook);
-            hash_index_bishop = bishop_hash_index(pos.all_pieces, square, n_attacks_bishop);
-            attacks = rook_covered_squares_bitboards[hash_index_rook] | bishop_covered_squares_bitboards[hash_index_bishop];
-            attacks &= ~pos.black_pieces; // excluse self-capture
-            // loop over all the attacks
-            while(attacks){
-                flags = 0;
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.white_pieces, target_square);
-                captured_piece_index = 15; // no capture 
-                // Generate new position applying the move
-                m.position = pos;
-                // move the piece in white pieces bitboards
-                bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                bit_clear(m.position.black_pieces, square); bit_set(m.position.black_pieces, target_square);
-                // if capture, also change bitboards of black pieces and recompute values
-                if(is_capture){
-                    flags += 8; // capture flag
-                    // check what black piece has been captured
-                    for(uint8_t index = 0; index < 6; index++){
-                        if(bit_get(pos.pieces[index], target_square)){
-                            captured_piece_index = index;
-                            break;
-                        }
-                    }
-                    //m.position.white_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    bit_clear(m.position.pieces[captured_piece_index], target_square);
-                    bit_clear(m.position.white_pieces, target_square);
-                }
-                else{ m.position.half_move_counter++; }
-                // compute all pieces bitboard and the covered squares
-                m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                // check if move is legal
-                is_illegal = m.position.pieces[6] & m.position.white_covered_squares;
-                if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                // standard updates
-                m.position.white_to_move = true;
-                m.position.en_passant_target_square = 0ULL;
-                // check if the move is a check
-                is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                if(is_check){ flags += 16; }
-                // encode move 
-                m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                all_moves[move_index] = m;
+    // -----------------
+    // ----- PAWNS -----
+    // -----------------
+    // pushes and captures of all the pawns at once, by shifting the bitboard of the pawns (see AddPawnMovesSetwise)
+    uint64_t pawns = pos.pieces[friendly + 5];
+    AddPawnMovesSetwise<Us>(pos, moves, move_index, pawns & ~pinned, target & pawn_type_mask, target & pawn_type_mask);
+    // a pinned pawn can only move along the line through the king and itself (rare: one pawn at a time)
+    piece = pawns & pinned;
+    while(piece){
+        square = get_last_active_bit(piece);
+        uint64_t pin_mask = target & pawn_type_mask & line_through[king_square][square];
+        AddPawnMovesSetwise<Us>(pos, moves, move_index, 1ULL << square, pin_mask, pin_mask);
+        clear_last_active_bit(piece);
+    }
+    // en-passant capture: at most two pawns attack the target square
+    // (they are seen from the target square with the pawn table of the opponent)
+    if(type != QUIETS && pos.en_passant_target_square){
+        target_square = get_last_active_bit(pos.en_passant_target_square);
+        // the captured pawn is behind the target square
+        unsigned long captured_square = target_square - pawn_push;
+        piece = pawn_covered_squares_table<~Us>()[target_square] & pawns;
+        while(piece){
+            square = get_last_active_bit(piece);
+            // two pawns leave the board at once, so pins are checked directly with the resulting occupancy
+            // (this catches the horizontal pin where both pawns are between the king and a rook)
+            uint64_t occupancy = (pos.all_pieces & ~(1ULL << square) & ~(1ULL << captured_square)) | pos.en_passant_target_square;
+            attacks_rook = rook_attacks(occupancy, king_square);
+            attacks_bishop = bishop_attacks(occupancy, king_square);
+            bool is_exposed = (attacks_rook & enemy_rooks_and_queens) ||
+                              (attacks_bishop & enemy_bishops_and_queens);
+            if(!is_exposed){
+                moves[move_index] = EncodeMoveNew(square, target_square, 5);
                 move_index++;
-                clear_last_active_bit(attacks); // remove considered attack
             }
-            // remove considered piece
             clear_last_active_bit(piece);
         }
+    }
 
-        // Rook
-        piece_index = 8;
-        piece = pos.pieces[piece_index];
-        while(piece){ // consider all the queens
-            _BitScanForward64(&square, piece); // find position of queen and assign it to square
-            // retrieve bitboard of queen moves
-            hash_index_rook = rook_hash_index(pos.all_pieces, square, n_attacks_rook);
-            attacks = rook_covered_squares_bitboards[hash_index_rook];
-            attacks &= ~pos.black_pieces; // excluse self-capture
-            // loop over all the attacks
-            while(attacks){
-                flags = 0;
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.white_pieces, target_square);
-                captured_piece_index = 15; // no capture 
-                // Generate new position applying the move
-                m.position = pos;
-                // move the piece in white pieces bitboards
-                bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                bit_clear(m.position.black_pieces, square); bit_set(m.position.black_pieces, target_square);
-                // if capture, also change bitboards of black pieces and recompute values
-                if(is_capture){
-                    flags += 8; // capture flag
-                    // check what black piece has been captured
-                    for(uint8_t index = 0; index < 6; index++){
-                        if(bit_get(pos.pieces[index], target_square)){
-                            captured_piece_index = index;
-                            break;
-                        }
-                    }
-                    //m.position.white_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    bit_clear(m.position.pieces[captured_piece_index], target_square);
-                    bit_clear(m.position.white_pieces, target_square);
-                }
-                else{ m.position.half_move_counter++; }
-                // compute all pieces bitboard and the covered squares
-                m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                // check if move is legal
-                is_illegal = m.position.pieces[6] & m.position.white_covered_squares;
-                if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                // castling rights are lost
-                if(square == 7) { m.position.can_black_castle_kingside = false; }
-                else if(square == 0) { m.position.can_black_castle_queenside = false; }
-                // standard updates
-                m.position.white_to_move = true;
-                m.position.en_passant_target_square = 0ULL;
-                // check if the move is a check
-                is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                if(is_check){ flags += 16; }
-                // encode move 
-                m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                all_moves[move_index] = m;
-                move_index++;
-                clear_last_active_bit(attacks); // remove considered attack
-            }
-            // remove considered piece
-            clear_last_active_bit(piece);
+    // --------------------
+    // ----- CASTLING -----
+    // --------------------
+    // the king cannot castle through or into a covered square (we are not in check here)
+    if(type != CAPTURES && king_square == king_home){
+        if(CanCastleKingside<Us>(pos) && (pos.all_pieces & (3ULL << (king_home + 1))) == 0 && (danger & (3ULL << (king_home + 1))) == 0 &&
+            bit_get(pos.pieces[friendly + 2], ColorTraits<Us>::kingside_rook_home)){
+            moves[move_index] = EncodeMoveNew(king_home, king_home + 2, 2);
+            move_index++;
+        }
+        if(CanCastleQueenside<Us>(pos) && (pos.all_pieces & (7ULL << (king_home - 3))) == 0 && (danger & (3ULL << (king_home - 2))) == 0 &&
+            bit_get(pos.pieces[friendly + 2], ColorTraits<Us>::queenside_rook_home)){
+            moves[move_index] = EncodeMoveNew(king_home, king_home - 2, 3);
+            move_index++;
         }
+    }
 
-        // Bishop
-        piece_index = 9;
-        piece = pos.pieces[piece_index]; // retrieve bitboard of bishops
-        while(piece){ // consider all the bishops
-            _BitScanForward64(&square, piece); // find position of queen and assign it to square
-            // retrieve bitboard of bishop moves
-            hash_index_bishop = bishop_hash_index(pos.all_pieces, square, n_attacks_bishop);
-            attacks = bishop_covered_squares_bitboards[hash_index_bishop];
-            attacks &= ~pos.black_pieces; // excluse self-capture
-            // loop over all the attacks
-            while(attacks){
-                flags = 0;
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.white_pieces, target_square);
-                captured_piece_index = 15; // no capture 
-                // Generate new position applying the move
-                m.position = pos;
-                // move the piece in white pieces bitboards
-                bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                bit_clear(m.position.black_pieces, square); bit_set(m.position.black_pieces, target_square);
-                // if capture, also change bitboards of black pieces and recompute values
-                if(is_capture){
-                    flags += 8; // capture flag
-                    // check what black piece has been captured
-                    for(uint8_t index = 0; index < 6; index++){
-                        if(bit_get(pos.pieces[index], target_square)){
-                            captured_piece_index = index;
-                            break;
-                        }
-                    }
-                    //m.position.white_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    bit_clear(m.position.pieces[captured_piece_index], target_square);
-                    bit_clear(m.position.white_pieces, target_square);
-                }
-                else{ m.position.half_move_counter++; }
-                // compute all pieces bitboard and the covered squares
-                m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                // check if move is legal
-                is_illegal = m.position.pieces[6] & m.position.white_covered_squares;
-                if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                // standard updates
-                m.position.white_to_move = true;
-                m.position.en_passant_target_square = 0ULL;
-                // check if the move is a check
-                is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                if(is_check){ flags += 16; }
-                // encode move 
-                m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                all_moves[move_index] = m;
-                move_index++;
-                clear_last_active_bit(attacks); // remove considered attack
-            }
-            // remove considered piece
-            clear_last_active_bit(piece);
-        }
+    return move_index;
+}
 
-        // Knight
-        piece_index = 10;
-        piece = pos.pieces[piece_index]; // retrieve bitboard of knights
-        while(piece){ // consider all the knights
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            attacks = knight_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.black_pieces; // exclude self-capture
-            while(attacks){
-                flags = 0;
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = bit_get(pos.white_pieces, target_square);
-                captured_piece_index = 15; // no capture 
-                // Generate new position applying the move
-                m.position = pos;
-                // move the piece in white pieces bitboards
-                bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                bit_clear(m.position.black_pieces, square); bit_set(m.position.black_pieces, target_square);
-                // if capture, also change bitboards of black pieces and recompute values
-                if(is_capture){
-                    flags += 8; // capture flag
-                    // check what black piece has been captured
-                    for(uint8_t index = 0; index < 6; index++){
-                        if(bit_get(pos.pieces[index], target_square)){
-                            captured_piece_index = index;
-                            break;
-                        }
-                    }
-                    //m.position.white_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    bit_clear(m.position.pieces[captured_piece_index], target_square);
-                    bit_clear(m.position.white_pieces, target_square);
-                }
-                else{ m.position.half_move_counter++; }
-                // compute all pieces bitboard and the covered squares
-                m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                // check if move is legal
-                is_illegal = m.position.pieces[6] & m.position.white_covered_squares;
-                if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                // standard updates
-                m.position.white_to_move = true;
-                m.position.en_passant_target_square = 0ULL;
-                // check if the move is a check
-                is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                if(is_check){ flags += 16; }
-                // encode move 
-                m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                all_moves[move_index] = m;
-                move_index++;
-                clear_last_active_bit(attacks); // remove considered attack
-            }
-            // remove considered piece
-            clear_last_active_bit(piece);
-        }
+template uint8_t LegalMovesNew<WHITE>(const Position& pos, MoveNew* moves, GenType type);
+template uint8_t LegalMovesNew<BLACK>(const Position& pos, MoveNew* moves, GenType type);
 
-        // Pawns 
-        piece_index = 11;
-        piece = pos.pieces[piece_index];
-        while(piece){
-            _BitScanForward64(&square, piece); // find position of piece and assign it to square
-            // CAPTURES
-            attacks = black_pawn_covered_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= pos.white_pieces | pos.en_passant_target_square; // only attacked squares occupied by enemy pieces are valid for movement
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = true; // this is necessarily a capture!
-                flags += 8; // capture flag
-                // check what white piece has been captured
-                for(uint8_t index = 0; index < 6; index++){
-                    if(bit_get(pos.pieces[index], target_square)){
-                        captured_piece_index = index;
-                        break;
-                    }
-                }
-                // in case of promotion, loop over all possible promoted pieces
-                if(target_square / 8 == 7){
-                    for(uint8_t promoted_piece_index = 7; promoted_piece_index < 11; promoted_piece_index++){
-                        flags = 1;
-                        // Generate new position applying the move
-                        m.position = pos;
-                        // move the piece in black pieces bitboards
-                        bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[promoted_piece_index], target_square);
-                        bit_clear(m.position.black_pieces, square); bit_set(m.position.black_pieces, target_square);
-                        // capture the piece 
-                        bit_clear(m.position.pieces[captured_piece_index], target_square);
-                        bit_clear(m.position.white_pieces, target_square);
-                        // update material value
-                        //m.position.black_material_value += PIECES_VALUES[promoted_piece_index] - BLACK_PAWN_VALUE;
-                        //m.position.white_material_value -= PIECES_VALUES[captured_piece_index];
-                        // compute all pieces bitboard and the covered squares
-                        m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                        m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                        m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                        // check if move is legal
-                        is_illegal = m.position.pieces[6] & m.position.white_covered_squares;
-                        if(is_illegal){ continue; }
-                        m.position.half_move_counter = 0;
-                        // standard updates
-                        m.position.white_to_move = true;
-                        m.position.en_passant_target_square = 0ULL;
-                        // check if the move is a check
-                        is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                        if(is_check){ flags += 16; }            
-                        m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, promoted_piece_index, flags);
-                        all_moves[move_index] = m;
-                        move_index++;
-                    }
-                }
-                else{
-                    flags = 1;
-                    // Generate new position applying the move
-                    m.position = pos;
-                    // move the piece in white pieces bitboards
-                    bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                    bit_clear(m.position.black_pieces, square); bit_set(m.position.black_pieces, target_square);
-                    // also change bitboards of enemy pieces and recompute values (this is always a capture)
-                    //m.position.white_material_value -= PIECES_VALUES[captured_piece_index];
-                    m.position.half_move_counter = 0;
-                    if((pos.en_passant_target_square & (1ULL << target_square)) == 0){ // NO en passant
-                        bit_clear(m.position.pieces[captured_piece_index], target_square);
-                        bit_clear(m.position.white_pieces, target_square);    
-                    }
-                    else{ // en passant
-                        captured_piece_index = 5;
-                        target_square -= 8;
-                        bit_clear(m.position.pieces[captured_piece_index], target_square);
-                        bit_clear(m.position.white_pieces, target_square);   
-                        target_square += 8;                 
-                    }   
-                    // compute all pieces bitboard and the covered squares
-                    m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                    m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                    m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                    // check if move is legal
-                    is_illegal = m.position.pieces[6] & m.position.white_covered_squares;
-                    if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                    // standard updates
-                    m.position.white_to_move = true;
-                    m.position.en_passant_target_square = 0ULL;
-                    // check if the move is a check
-                    is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                    if(is_check){ flags += 16; }
-                    m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, captured_piece_index, 15/*no promotion*/, flags);
-                    all_moves[move_index] = m;
-                    move_index++;
-                }
-                clear_last_active_bit(attacks); // remove considered attack
-            }
+uint8_t LegalMovesNew(const Position& pos, MoveNew* moves, GenType type){
+    return pos.white_to_move ? LegalMovesNew<WHITE>(pos, moves, type) : LegalMovesNew<BLACK>(pos, moves, type);
+}
 
-            // PUSH
-            attacks = black_pawn_advance_squares_bitboards[square]; // retrieve attack bitboard
-            attacks &= ~pos.all_pieces; // control that there are no blockers in front
-            if((square/8 == 1) && !bit_get(attacks, square + 8) && bit_get(attacks, square + 16)){
-                attacks = 0ULL;
-            }
-            while(attacks){
-                _BitScanForward64(&target_square, attacks); // find the target square
-                is_capture = false; // this is necessarily NOT a capture!
-                // in case of promotion, loop over all possible promoted pieces
-                if(target_square / 8 == 7){
-                    for(uint8_t promoted_piece_index = 7; promoted_piece_index < 11; promoted_piece_index++){
-                        flags = 1;
-                        // Generate new position applying the move
-                        m.position = pos;
-                        // move the piece in white pieces bitboards
-                        bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[promoted_piece_index], target_square);
-                        bit_clear(m.position.black_pieces, square); bit_set(m.position.black_pieces, target_square);
-                        //m.position.black_material_value += PIECES_VALUES[promoted_piece_index] - BLACK_PAWN_VALUE;
-                        // compute all pieces bitboard and the covered squares
-                        m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                        m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                        m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                        // check if move is legal
-                        is_illegal = m.position.pieces[6] & m.position.white_covered_squares;
-                        if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                        m.position.half_move_counter = 0;
-                        // standard updates
-                        m.position.white_to_move = true;
-                        m.position.en_passant_target_square = 0ULL;
-                        // check if the move is a check
-                        is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                        if(is_check){ flags += 16; }             
-                        // flag that this is a promotion ...
-                        m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, 15/*no capture*/, promoted_piece_index, flags);
-                        all_moves[move_index] = m;
-                        move_index++;
-                    }
-                }
-                // if this is a double push, flag it to manage en-passant target squares
-                else if(target_square / 8 == 3 && square / 8 == 1){
-                    flags = 1;
-                    // Generate new position applying the move
-                    m.position = pos;
-                    // move the piece in white pieces bitboards
-                    bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                    bit_clear(m.position.black_pieces, square); bit_set(m.position.black_pieces, target_square);
-                    // compute all pieces bitboard and the covered squares
-                    m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                    m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                    m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                    // check if move is legal
-                    is_illegal = m.position.pieces[6] & m.position.white_covered_squares;
-                    if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                    m.position.half_move_counter = 0;
-                    // update side to move and add en-passant target!
-                    m.position.white_to_move = true;
-                    m.position.en_passant_target_square = 0ULL; 
-                    m.position.en_passant_target_square |= (1ULL << (target_square - 8));
-                    // check if the move is a check
-                    is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                    if(is_check){ flags += 16; }   
-                    // encode move
-                    flags += 2;
-                    m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, 15/*no capture*/, 15/*no promotion*/, flags);
-                    all_moves[move_index] = m;
-                    move_index++;
-                }
-                else{
-                    flags = 1;
-                    // Generate new position applying the move
-                    m.position = pos;
-                    // move the piece in white pieces bitboards
-                    bit_clear(m.position.pieces[piece_index], square); bit_set(m.position.pieces[piece_index], target_square);
-                    bit_clear(m.position.black_pieces, square); bit_set(m.position.black_pieces, target_square);
-                    // compute all pieces bitboard and the covered squares
-                    m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                    m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                    m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                    // check if move is legal
-                    is_illegal = m.position.pieces[6] & m.position.white_covered_squares;
-                    if(is_illegal){ clear_last_active_bit(attacks); continue; }
-                    m.position.half_move_counter = 0;
-                    // standard updates
-                    m.position.white_to_move = true;
-                    m.position.en_passant_target_square = 0ULL;
-                    // check if the move is a check
-                    is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                    if(is_check){ flags += 16; }   
-                    // encode move if legal 
-                    m.move = EncodeMove(static_cast<uint8_t>(square), static_cast<uint8_t>(target_square), piece_index, 15/*no capture*/, 15/*no promotion*/, flags);
-                    all_moves[move_index] = m;
-                    move_index++;
-                }
-                clear_last_active_bit(attacks); // remove considered attack
-            }
-            // remove considered piece
-            clear_last_active_bit(piece);
-        }
+// HAS LEGAL MOVE
+// Same per-node information as LegalMovesNew (checkers, pins, danger), but we stop at the first legal move:
+// first the king (in most positions it has a free square), then the other pieces from the cheapest to compute.
+// The castling moves are never needed: if castling is legal, the king can also step on the square next to it
+template<Color Us>
+bool HasLegalMove(const Position& pos){
+    constexpr uint8_t friendly = ColorTraits<Us>::friendly;
+    constexpr uint8_t enemy = ColorTraits<Us>::enemy;
+    constexpr int pawn_push = ColorTraits<Us>::pawn_push;
+    uint64_t pieces, attacks, snipers, blockers, pinned = 0ULL;
+    unsigned long square;
+    const uint64_t friendly_pieces = PiecesOf<Us>(pos);
+    const uint64_t enemy_pieces = PiecesOf<~Us>(pos);
+    const uint64_t enemy_rooks_and_queens = pos.pieces[enemy + 1] | pos.pieces[enemy + 2];
+    const uint64_t enemy_bishops_and_queens = pos.pieces[enemy + 1] | pos.pieces[enemy + 3];
+    const uint64_t danger = CoveredSquares<~Us>(pos);
+    if(pos.pieces[friendly] == 0){ return false; }
+    const unsigned long king_square = get_last_active_bit(pos.pieces[friendly]);
+    const bool in_check = bit_get_opt(danger, king_square);
 
-        // Castles kingside
-        if(pos.can_black_castle_kingside){ 
-            if(!bit_get(pos.all_pieces, 5) && 
-                !bit_get(pos.all_pieces, 6)){ 
-                if(!bit_get(pos.white_covered_squares, 4) &&
-                    !bit_get(pos.white_covered_squares, 5) &&
-                    !bit_get(pos.white_covered_squares, 6)){ 
-                   if(bit_get(pos.pieces[6], 4) &&
-                        bit_get(pos.pieces[8], 7)){ 
-                        flags = 4;
-                        // Generate new position applying the move
-                        m.position = pos;
-                        // move king and rook in white pieces bitboards
-                        m.position.pieces[6] &= ~(1ULL << 4);
-                        m.position.pieces[6] |= (1ULL << 6);
-                        m.position.pieces[8] &= ~(1ULL << 7);
-                        m.position.pieces[8] |= (1ULL << 5);
-                        m.position.black_pieces &= ~(1ULL << 4);
-                        m.position.black_pieces &= ~(1ULL << 7);
-                        m.position.black_pieces |= (1ULL << 5);
-                        m.position.black_pieces |= (1ULL << 6);
-                        // compute all pieces bitboard and the covered squares
-                        m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                        m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                        m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                        m.position.half_move_counter++;
-                        // standard updates -> loose castling rights
-                        m.position.white_to_move = true;
-                        m.position.can_black_castle_kingside = false;
-                        m.position.can_black_castle_queenside = false;
-                        m.position.en_passant_target_square = 0ULL;
-                        // check if the move is a check
-                        is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                        if(is_check){ flags += 16; }   
-                        m.move = EncodeMove(4, 6, 6/*king*/, 15/*no capture*/, 15/*no promotion*/, flags); 
-                        all_moves[move_index] = m;
-                        move_index++;
-                   } 
-                }
-            }   
+    // ----------------
+    // ----- KING -----
+    // ----------------
+    attacks = king_covered_squares_bitboards[king_square] & ~friendly_pieces & ~danger;
+    // not in check, the covered squares are the same with or without our king (see LegalMovesNew): nothing else to check
+    if(attacks && !in_check){ return true; }
+    // in check, a square behind the king along the checking ray looks free: look at it without the king on the board
+    while(attacks){
+        square = get_last_active_bit(attacks);
+        if((AttackersTo(pos, square, pos.all_pieces ^ (1ULL << king_square)) & enemy_pieces) == 0){ return true; }
+        clear_last_active_bit(attacks);
+    }
+
+    // in check, the other pieces can only capture the checker or block it (none of them can do it in double check)
+    uint64_t target_squares = ~friendly_pieces;
+    if(in_check){
+        uint64_t checkers = AttackersTo(pos, king_square, pos.all_pieces) & enemy_pieces;
+        if(checkers & (checkers - 1)){ return false; }
+        target_squares = checkers | squares_between[king_square][get_last_active_bit(checkers)];
+    }
+    // PINNED PIECES (see LegalMovesNew): they can only move along the line through the king.
+    // In check this is empty: the pin line and the checking line only meet on the king square
+    snipers = (rook_attacks(enemy_pieces, king_square) & enemy_rooks_and_queens) |
+              (bishop_attacks(enemy_pieces, king_square) & enemy_bishops_and_queens);
+    while(snipers){
+        square = get_last_active_bit(snipers);
+        blockers = squares_between[king_square][square] & pos.all_pieces;
+        if(blockers && (blockers & (blockers - 1)) == 0){
+            pinned |= blockers & friendly_pieces;
+        }
+        clear_last_active_bit(snipers);
+    }
+
+    // ------------------
+    // ----- KNIGHT -----
+    // ------------------
+    // a pinned knight can never move
+    pieces = pos.pieces[friendly + 4] & ~pinned;
+    while(pieces){
+        square = get_last_active_bit(pieces);
+        if(knight_covered_squares_bitboards[square] & target_squares){ return true; }
+        clear_last_active_bit(pieces);
+    }
+    // ----------------
+    // ----- PAWN -----
+    // ----------------
+    pieces = pos.pieces[friendly + 5];
+    while(pieces){
+        square = get_last_active_bit(pieces);
+        attacks = pawn_covered_squares_table<Us>()[square] & enemy_pieces;
+        if(!bit_get_opt(pos.all_pieces, square + pawn_push)){
+            attacks |= 1ULL << (square + pawn_push);
+            if(square / 8 == ColorTraits<Us>::starting_rank && !bit_get_opt(pos.all_pieces, square + 2*pawn_push)){
+                attacks |= 1ULL << (square + 2*pawn_push);
+            }
         }
-        // Castles queenside
-        if(pos.can_black_castle_queenside){ 
-            if(!bit_get(pos.all_pieces, 3) && 
-                !bit_get(pos.all_pieces, 2) &&
-                !bit_get(pos.all_pieces, 1)){ 
-                if(!bit_get(pos.white_covered_squares, 4) &&
-                    !bit_get(pos.white_covered_squares, 3) &&
-                    !bit_get(pos.white_covered_squares, 2)){
-                   if(bit_get(pos.pieces[6], 4) &&
-                        bit_get(pos.pieces[8], 0)){ 
-                        flags = 4;
-                        // Generate new position applying the move
-                        m.position = pos;
-                        // move king and rook in white pieces bitboards
-                        m.position.pieces[6] &= ~(1ULL << 4);
-                        m.position.pieces[6] |= (1ULL << 2);
-                        m.position.pieces[8] &= ~1ULL;
-                        m.position.pieces[8] |= (1ULL << 3);
-                        m.position.black_pieces &= ~(1ULL << 4);
-                        m.position.black_pieces &= ~1ULL;
-                        m.position.black_pieces |= (1ULL << 2);
-                        m.position.black_pieces |= (1ULL << 3);
-                        // compute all pieces bitboard and the covered squares
-                        m.position.all_pieces = m.position.white_pieces | m.position.black_pieces;
-                        m.position.white_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, true);
-                        m.position.black_covered_squares = GetCoveredSquares(m.position.pieces, m.position.all_pieces, false);
-                        m.position.half_move_counter++;
-                        // standard updates
-                        m.position.white_to_move = true;
-                        m.position.can_black_castle_kingside = false;
-                        m.position.can_black_castle_queenside = false;
-                        m.position.en_passant_target_square = 0ULL;
-                        // check if the move is a check
-                        is_check = m.position.pieces[0] & m.position.black_covered_squares;
-                        if(is_check){ flags += 16; }   
-                        m.move = EncodeMove(4, 2, 6/*king*/, 15/*no capture*/, 15/*no promotion*/, flags); 
-                        all_moves[move_index] = m;
-                        move_index++;
-                   } 
-                }
-            }   
+        if(bit_get_opt(pinned, square)){ attacks &= line_through[king_square][square]; }
+        if(attacks & target_squares){ return true; }
+        clear_last_active_bit(pieces);
+    }
+    // ----------------------------------
+    // ----- BISHOP, ROOK AND QUEEN -----
+    // ----------------------------------
+    pieces = pos.pieces[friendly + 3] | pos.pieces[friendly + 2] | pos.pieces[friendly + 1];
+    while(pieces){
+        square = get_last_active_bit(pieces);
+        attacks = 0ULL;
+        if(!bit_get_opt(pos.pieces[friendly + 3], square)){ attacks |= rook_attacks(pos.all_pieces, square); }
+        if(!bit_get_opt(pos.pieces[friendly + 2], square)){ attacks |= bishop_attacks(pos.all_pieces, square); }
+        if(bit_get_opt(pinned, square)){ attacks &= line_through[king_square][square]; }
+        if(attacks & target_squares){ return true; }
+        clear_last_active_bit(pieces);
+    }
+    // ----------------------
+    // ----- EN-PASSANT -----
+    // ----------------------
+    // two pawns leave the board at once (pins, checks and the horizontal exposure of the king): look at the board after the move
+    if(pos.en_passant_target_square){
+        const unsigned long target_square = get_last_active_bit(pos.en_passant_target_square);
+        const uint64_t captured = 1ULL << (target_square - pawn_push);
+        pieces = pawn_covered_squares_table<~Us>()[target_square] & pos.pieces[friendly + 5];
+        while(pieces){
+            square = get_last_active_bit(pieces);
+            uint64_t occupancy = (pos.all_pieces ^ (1ULL << square) ^ captured) | pos.en_passant_target_square;
+            if((AttackersTo(pos, king_square, occupancy) & enemy_pieces & ~captured) == 0){ return true; }
+            clear_last_active_bit(pieces);
         }
     }
+    return false;
+}
+
+template bool HasLegalMove<WHITE>(const Position& pos);
+template bool HasLegalMove<BLACK>(const Position& pos);
 
-    pos.n_legal_moves = move_index;
-}
\ No newline at end of file
+bool HasLegalMove(const Position& pos){
+    return pos.white_to_move ? HasLegalMove<WHITE>(pos) : HasLegalMove<BLACK>(pos);
+}
@@ -7,6 +7,7 @@ void TTInit(){
         transposition_table[i].depth = -1;
         transposition_table[i].flag = EXACT;
         transposition_table[i].score = 0;
+        transposition_table[i].best_move = 0;
     }
 }
 
@@ -20,10 +21,12 @@ TTEntry* TTProbe(uint64_t zobrist_key){
     return nullptr;
 }
 
-void TTStore(int depth, uint64_t hash, int score, NodeFlag flag/*, Move best_move*/){
+void TTStore(int depth, uint64_t hash, int score, NodeFlag flag, MoveNew best_move){
     TTEntry& entry = transposition_table[hash % TT_SIZE];
     if(entry.hash != hash || depth > entry.depth){
-        entry = {depth, hash, score, flag/*, best_move*/};
+        // keep the old move of the same position if the new search did not find one
+        if(best_move == 0 && entry.hash == hash){ best_move = entry.best_move; }
+        entry = {depth, hash, score, flag, best_move};
     }
 }
 
@@ -44,7 +47,7 @@ void InitializeZobrist(){
     }
 }
 
-uint64_t ZobristHashing(Position& pos) {
+uint64_t ZobristHashing(const Position& pos) {
     // initialize value of 0
     uint64_t hash = 0;
     uint64_t piece;
@@ -53,22 +56,16 @@ uint64_t ZobristHashing(Position& pos) {
     for(int piece_index = 0; piece_index < 12; piece_index++){
         piece = pos.pieces[piece_index];
         while(piece){
-            _BitScanForward64(&square, piece);
+            square = get_last_active_bit(piece);
             hash ^= zobrist_table.pieces_and_squares[piece_index][square];
             clear_last_active_bit(piece);
         }
     }
     // encode side to move
     if(pos.white_to_move){ hash ^= zobrist_table.white_to_move; }
-    // encode castling rights
-    if(pos.can_white_castle_kingside){ hash ^= zobrist_table.castling_rights[0]; }
-    else if(pos.can_white_castle_queenside){ hash ^= zobrist_table.castling_rights[1]; }
-    else if(pos.can_black_castle_kingside){ hash ^= zobrist_table.castling_rights[2]; }
-    else if(pos.can_black_castle_queenside){ hash ^= zobrist_table.castling_rights[3]; }
+    // encode castling rights (each right independently)
+    hash ^= ZobristCastling(pos);
     // encode en-passant target
-    if(pos.en_passant_target_square){ 
-        _BitScanForward64(&square, pos.en_passant_target_square);
-        hash ^= zobrist_table.en_passant_file[square % 8];
-    }
+    hash ^= ZobristEnPassant(pos);
     return hash;
 }
\ No newline at end of file
@@ -2,6 +2,17 @@
 #include <random>
 #include <cassert>
 #include <fstream>
+#include <cstdio>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 std::mt19937_64 rng(20250704); // Fixed seed for reproducibility
 uint64_t rand64(){
@@ -16,7 +27,7 @@ int IntPow(int x, unsigned int p){
     else return x * tmp * tmp;
 }
 
-void write_to_file(uint64_t* arr, size_t size, std::string file_name){
+void write_to_file(const uint64_t* arr, size_t size, std::string file_name){
     std::ofstream fout(file_name);
     if(!fout){
         std::cout << "Unable to write data on file. \n";
@@ -41,47 +52,62 @@ void read_from_file(uint64_t* arr, size_t size, std::string file_name){
     fin.close();
 }
 
-
-void bit_set(uint64_t& bitboard, int i, int j){
-    bitboard |= (1ULL << (8*i+j));
-    return;
-}
-void bit_set(uint64_t& bitboard, unsigned long& square){
-    bitboard |= (1ULL << square);
-}
-void bit_set_opt(uint64_t& bitboard, const uint8_t& square){
-    bitboard |= (1ULL << square);
-}
-
-void bit_clear(uint64_t bitboard, int i, int j){
-    bitboard &= ~(1ULL << (8*i+j));
-}
-void bit_clear(uint64_t& bitboard, unsigned long& square){
-    bitboard &= ~(1ULL << square);
-}
-void bit_clear_opt(uint64_t& bitboard, const uint8_t& square){
-    bitboard &= ~(1ULL << square);
-}
-
-bool bit_get(uint64_t bitboard, int i, int j){
-    return (bitboard >> (8*i+j)) & 1;
-}
-bool bit_get(const uint64_t& bitboard, const unsigned long& square){
-    return (bitboard >> square) & 1;
-}
-bool bit_get_opt(const uint64_t& bitboard, const uint8_t& square){
-    return (bitboard >> square) & 1;
-}
-
-
-void clear_last_active_bit(uint64_t& bitboard){
-    bitboard &= bitboard - 1;
+bool write_to_binary_file(const uint64_t* arr, size_t size, std::string file_name){
+    std::ofstream fout(file_name, std::ios::binary);
+    if(!fout){ return false; }
+    fout.write(reinterpret_cast<const char*>(arr), size * sizeof(uint64_t));
+    // close flushes the buffer: a failed write can show up only here
+    fout.close();
+    return !fout.fail();
+}
+
+bool replace_file(std::string old_file_name, std::string new_file_name){
+#ifdef _WIN32
+    return MoveFileExA(old_file_name.c_str(), new_file_name.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    // rename replaces the destination atomically
+    return std::rename(old_file_name.c_str(), new_file_name.c_str()) == 0;
+#endif
+}
+
+const uint64_t* map_binary_file(std::string file_name, size_t& size){
+    size = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE){ return nullptr; }
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart < (LONGLONG)sizeof(uint64_t)){ CloseHandle(file); return nullptr; }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if(mapping == NULL){ return nullptr; }
+    // the view keeps the mapping alive
+    const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if(data == NULL){ return nullptr; }
+    size = (size_t)file_size.QuadPart / sizeof(uint64_t);
+#else
+    int file = open(file_name.c_str(), O_RDONLY);
+    if(file < 0){ return nullptr; }
+    struct stat file_stat;
+    if(fstat(file, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(uint64_t)){ close(file); return nullptr; }
+    // the mapping stays valid after closing the file
+    void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if(data == MAP_FAILED){ return nullptr; }
+    size = (size_t)file_stat.st_size / sizeof(uint64_t);
+#endif
+    return static_cast<const uint64_t*>(data);
+}
+
+void unmap_binary_file(const uint64_t* data, size_t size){
+    if(data == nullptr){ return; }
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap(const_cast<uint64_t*>(data), size * sizeof(uint64_t));
+#endif
 }
 
-size_t pop_count(uint64_t& bitboard){
-    std::bitset<64> b(bitboard);
-    return b.count();
-}
 
 void PrintBitboard(uint64_t bitboard){
     int i, j;
@@ -0,0 +1,113 @@
+#include <Bitboards.h>
+#include <Utilities.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// Build step for BACCALA_EMBEDDED_TABLES (see Bitboards.h):
+// read the magic numbers (and their number of bits) from the assets, compute the attack tables in the magic order and in the PEXT order
+// and write everything as C++ arrays that are compiled in the engine.
+// With a third argument, the same tables are also written in the binary files that the engine maps at start-up (BINARY TABLE FILE),
+// one in the magic order and one in the PEXT order, in the given directory.
+// usage: GenerateTables <assets directory> <output .cpp file> [<output directory of the binary files>]
+// With --densest, it searches the densest magics instead (see DENSEST MAGICS), trying at most max_trials random numbers
+// for every number of bits, and writes them in the assets: the next build compiles the smaller tables.
+// usage: GenerateTables --densest <assets directory> <max trials>
+
+// write one array of the output file, 4 numbers per line
+static void write_array(std::ofstream& fout, const char* name, int size, const uint64_t* arr, int n){
+    fout << "const uint64_t " << name << "[" << size << "] = {\n";
+    for(int index = 0; index < n; index++){
+        if(index % 4 == 0){ fout << "    "; }
+        fout << "0x" << std::hex << arr[index] << std::dec << "ULL";
+        if(index < n - 1){ fout << ","; }
+        fout << ((index % 4 == 3 || index == n - 1) ? "\n" : " ");
+    }
+    fout << "};\n\n";
+}
+
+// true if every configuration of blockers finds its attacks at its magic index (i.e. the magic numbers are good)
+static bool check_attack_tables(){
+    uint64_t blockers, index;
+    int i, j;
+    for(int square = 0; square < 64; square++){
+        i = square / 8; j = square % 8;
+        blockers = 0ULL;
+        do{
+            index = rook_offsets[square] + ((blockers * rook_magics[square]) >> rook_shifts[square]);
+            if(rook_covered_squares_bitboards[index] != rook_covered_squares_from_blockers(blockers, i, j)){ return false; }
+            blockers = (blockers - rook_masks[square]) & rook_masks[square];
+        } while(blockers);
+        blockers = 0ULL;
+        do{
+            index = bishop_offsets[square] + ((blockers * bishop_magics[square]) >> bishop_shifts[square]);
+            if(bishop_covered_squares_bitboards[index] != bishop_covered_squares_from_blockers(blockers, i, j)){ return false; }
+            blockers = (blockers - bishop_masks[square]) & bishop_masks[square];
+        } while(blockers);
+    }
+    return true;
+}
+
+// the number of bits of every square, 8 numbers per line
+static void write_n_bits(std::ofstream& fout, const char* name, const int* n_bits){
+    fout << "const int " << name << "[64] = {\n";
+    for(int square = 0; square < 64; square++){
+        if(square % 8 == 0){ fout << "    "; }
+        fout << n_bits[square] << ((square < 63) ? "," : "") << ((square % 8 == 7) ? "\n" : " ");
+    }
+    fout << "};\n\n";
+}
+
+int main(int argc, char* argv[]){
+    if(argc == 4 && std::string(argv[1]) == "--densest"){
+        uint64_t max_trials = std::stoull(argv[3]);
+        uint64_t densest_rook_magics[64], densest_bishop_magics[64];
+        find_densest_rook_magics(rook_n_bits, densest_rook_magics, max_trials);
+        find_densest_bishop_magics(bishop_n_bits, densest_bishop_magics, max_trials);
+        rook_magics = densest_rook_magics;
+        bishop_magics = densest_bishop_magics;
+        write_magics_to_assets(argv[2]);
+        return 0;
+    }
+    if(argc != 3 && argc != 4){
+        std::cout << "Usage: GenerateTables <assets directory> <output file> [<output directory of the binary files>]\n";
+        std::cout << "       GenerateTables --densest <assets directory> <max trials>\n";
+        return 1;
+    }
+    std::string assets_directory = argv[1];
+    read_magics_from_assets(assets_directory);
+    fill_attack_tables();
+    if(!check_attack_tables()){
+        std::cout << "The magic numbers in " << assets_directory << " don't work: run PreComputeBitboards(false) to find new ones.\n";
+        return 1;
+    }
+
+    std::ofstream fout(argv[2]);
+    if(!fout){
+        std::cout << "Unable to write data on file. \n";
+        return 1;
+    }
+    fout << "// Generated by GenerateTables from the magic numbers in the assets: do not edit.\n";
+    fout << "#include <Bitboards.h>\n\n";
+    write_array(fout, "embedded_rook_magics", 64, rook_magics, 64);
+    write_n_bits(fout, "embedded_rook_n_bits", rook_n_bits);
+    write_array(fout, "embedded_rook_attacks", n_magic_attacks_rook, rook_covered_squares_bitboards, n_magic_attacks_rook);
+    write_array(fout, "embedded_bishop_magics", 64, bishop_magics, 64);
+    write_n_bits(fout, "embedded_bishop_n_bits", bishop_n_bits);
+    write_array(fout, "embedded_bishop_attacks", n_magic_attacks_bishop, bishop_covered_squares_bitboards, n_magic_attacks_bishop);
+    // the binary file of the magic order, then the same tables rewritten in the PEXT order (no PEXT instruction needed)
+    if(argc == 4 && !write_attack_tables_file(std::string(argv[3]) + "/" + attack_tables_file_name(MAGIC_BACKEND))){
+        std::cout << "Unable to write the binary file of the magic order in " << argv[3] << "\n";
+        return 1;
+    }
+    set_sliders_backend(PEXT_BACKEND);
+    write_array(fout, "embedded_rook_pext_attacks", n_attacks_rook, rook_covered_squares_bitboards, n_attacks_rook);
+    write_array(fout, "embedded_bishop_pext_attacks", n_attacks_bishop, bishop_covered_squares_bitboards, n_attacks_bishop);
+    fout.close();
+    if(argc == 4 && !write_attack_tables_file(std::string(argv[3]) + "/" + attack_tables_file_name(PEXT_BACKEND))){
+        std::cout << "Unable to write the binary file of the PEXT order in " << argv[3] << "\n";
+        return 1;
+    }
+    CleanBitboards();
+    return 0;
+}
@@ -35,29 +35,29 @@ int main(){
         pseudolegal_moves[move_index] = 0;
     }
     MoveNew move;
-    StateMemory state;
+    UndoStack undo;
 
     PseudoLegalMoves(pos, pseudolegal_moves); */
 
 //    IterativeDeepening(pos, 2, max_depth, 2);
     //PerftTesting();
-    PerftNewTesting();
+    PerftLegalTesting();
 
 /*    int perft = 0, total = 0;
 
     for(int move_index = 0; move_index < 256; move_index++){
         move = pseudolegal_moves[move_index];
         if(move == 0){ break; }
-        MakeMove(pos, move, state);
+        MakeMove(pos, move, undo);
         if(!IsLegal(pos, move)){
-            UnmakeMove(pos, move, state); 
+            UnmakeMove(pos, move, undo); 
             continue; 
         }
         PrintMoveNew(move);
-        perft = PerftNew(pos, max_depth - 1, state);
+        perft = PerftNew(pos, max_depth - 1, undo);
         total += perft;
         std::cout << "Perft = " << perft << "\n";
-        UnmakeMove(pos, move, state);
+        UnmakeMove(pos, move, undo);
     }
 
     std::cout << "\nPerft = " << total << "\n"; */